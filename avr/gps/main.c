@@ -49,11 +49,14 @@ void onPoll() {
 	altSize = str - alt;
 	
 	//Update server
-	purt_set_substate(_("utc"), utc, utcSize);
-	purt_set_substate(_("lat"), latitude, latitudeSize);
-	purt_set_substate(_("long"), longitude, longitudeSize);
-	purt_set_substate(_("hDilution"), hDilution, hDilutionSize);
-	purt_set_substate(_("alt"), alt, altSize);
+	const Purt_Substate fix[] = {
+		{(const unsigned char*)"utc", 3, (const unsigned char*)utc, utcSize},
+		{(const unsigned char*)"lat", 3, (const unsigned char*)latitude, latitudeSize},
+		{(const unsigned char*)"long", 4, (const unsigned char*)longitude, longitudeSize},
+		{(const unsigned char*)"hDilution", 9, (const unsigned char*)hDilution, hDilutionSize},
+		{(const unsigned char*)"alt", 3, (const unsigned char*)alt, altSize}
+	};
+	purt_set_substates(fix, sizeof(fix) / sizeof(fix[0])); //sent together so lat/long always match
 }
 void onHandshake(void) {}
 void onSubstate(Purt_Substate* s) {}
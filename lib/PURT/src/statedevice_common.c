@@ -42,6 +42,53 @@ void purt_set_substate(const char* key, unsigned char keyLength, const char* val
 		PURT_UART_BLOCK_SET_BYTE(value[i]);
 	PURT_UART_BLOCK_SET_BYTE(~size);
 }
+unsigned char purt_set_substates(const Purt_Substate* substates, unsigned char count) {
+	unsigned int total = 2; //size and type
+	unsigned char i, j;
+	for(i = 0; i < count; i++)
+		total += 2 + substates[i].keyLength + substates[i].valueLength + (substates[i].valueLength >= 0x80);
+	if(total > 0xFF)
+		return 0;
+	const unsigned char size = total;
+	PURT_UART_BLOCK_SET_BYTE(size);
+	PURT_UART_BLOCK_SET_BYTE(0x03);
+	for(i = 0; i < count; i++) {
+		const Purt_Substate* s = &substates[i];
+		PURT_UART_BLOCK_SET_BYTE(s->keyLength);
+		for(j = 0; j < s->keyLength; j++)
+			PURT_UART_BLOCK_SET_BYTE(s->key[j]);
+		if(s->valueLength >= 0x80) { //value length is a varint: low seven bits first, high bit set if more follow
+			PURT_UART_BLOCK_SET_BYTE(s->valueLength | 0x80);
+			PURT_UART_BLOCK_SET_BYTE(s->valueLength >> 7);
+		} else
+			PURT_UART_BLOCK_SET_BYTE(s->valueLength);
+		for(j = 0; j < s->valueLength; j++)
+			PURT_UART_BLOCK_SET_BYTE(s->value[j]);
+	}
+	PURT_UART_BLOCK_SET_BYTE(~size);
+	return 1;
+}
+void purt_assign_key_id(unsigned char id, const char* key, unsigned char keyLength) {
+	const unsigned char size = 4 + keyLength;
+	PURT_UART_BLOCK_SET_BYTE(size);
+	PURT_UART_BLOCK_SET_BYTE(0x04);
+	PURT_UART_BLOCK_SET_BYTE(keyLength);
+	unsigned char i;
+	for(i = 0; i < keyLength; i++)
+		PURT_UART_BLOCK_SET_BYTE(key[i]);
+	PURT_UART_BLOCK_SET_BYTE(id);
+	PURT_UART_BLOCK_SET_BYTE(~size);
+}
+void purt_set_substate_by_id(unsigned char id, const char* value, unsigned char valueLength) {
+	const unsigned char size = 3 + valueLength;
+	PURT_UART_BLOCK_SET_BYTE(size);
+	PURT_UART_BLOCK_SET_BYTE(0x05);
+	PURT_UART_BLOCK_SET_BYTE(id);
+	unsigned char i;
+	for(i = 0; i < valueLength; i++)
+		PURT_UART_BLOCK_SET_BYTE(value[i]);
+	PURT_UART_BLOCK_SET_BYTE(~size);
+}
 void purt_register_substate(const char* key, unsigned char keyLength) {
 	const unsigned char size = 3 + keyLength;
 	PURT_UART_BLOCK_SET_BYTE(size);
@@ -45,6 +45,43 @@ void purt_ask_substate(const char* key, unsigned char keyLength);
   */
 void purt_set_substate(const char* key, unsigned char keyLength, const char* value, unsigned char valueLength);
 
+/** Sets several Substates over serial link in a single message. The
+  * server applies them together, so related values (e.g., latitude and
+  * longitude) are never seen out of step, and the link carries one frame
+  * rather than one per substate.
+  *
+  * @note Requires a server that understands batch messages. Older servers
+  *	do not ignore them: they treat the unknown message type as an error
+  *	and disconnect the device.
+  *
+  * @param substates substates to set
+  * @param count number of substates
+  * @return nonzero if sent; 0 if the substates do not fit in one message, in
+  *	which case nothing is sent
+  */
+unsigned char purt_set_substates(const Purt_Substate* substates, unsigned char count);
+
+/** Assigns a key a one-byte ID for the rest of the session, after which
+  * purt_set_substate_by_id() can set it without sending the key. Assigning
+  * an ID again replaces the previous assignment.
+  *
+  * @note IDs are forgotten by the server whenever a new session starts, so
+  *	the device should assign them in onHandshake().
+  *
+  * @param id ID to assign
+  * @param key key
+  * @param keyLength key length
+  */
+void purt_assign_key_id(unsigned char id, const char* key, unsigned char keyLength);
+
+/** Sets a Substate over serial link by the ID assigned to its key with
+  * purt_assign_key_id().
+  * @param id ID of key
+  * @param value value
+  * @param valueLength value length
+  */
+void purt_set_substate_by_id(unsigned char id, const char* value, unsigned char valueLength);
+
 /** Registers a Substate for a push relationship over serial link.
   * The server will automatically send a registered substate when it changes
   * (unless the substate has been marked as send-on-touch on the server) as if
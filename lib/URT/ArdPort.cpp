@@ -27,79 +27,262 @@
 #include <cstring> //for std::memset
 #include "Log.h"
 #include <poll.h>
+#include <ctime>
+#include "Varint.h"
+#include "RxBuffer.h"
 
 using namespace urt;
 
-static const tcflag_t BAUD_RATES[] = {B2400, B19200};
+/** Baud rates tried in turn during the handshake. */
+static const struct BaudRate {
+	tcflag_t flag;
+	unsigned int bps;
+} BAUD_RATES[] = {{B2400, 2400}, {B19200, 19200}};
 static const size_t NUM_BAUD_RATES = sizeof(BAUD_RATES)/sizeof(*BAUD_RATES);
-static const int HANDSHAKE_BYTE_TIMEOUT = 5; //deciseconds
-
-ArdPort::ArdPort(const char *dev) throw (SerialException) : SerialPort(dev, BAUD_RATES[0], false, true, CS8) {
-	setTimeout(HANDSHAKE_BYTE_TIMEOUT);
-	for(const tcflag_t* baud = &BAUD_RATES[0]; baud < BAUD_RATES + NUM_BAUD_RATES; baud++) {
-		//set baud rate
-		setSpeed(*baud);
-		
-		//send handshaking sequence
-		/* Flush connection with 255 null bytes */ {
-			char flush[255];
-			std::memset(flush, 0, 255);
-			send(flush, 255);
-		}
-		flushInput();
-		sendDatagram(0xFF, NULL, 0); //no message
-		
-		struct pollfd pfd = {fdesc, POLLIN, 0};
-		if(poll(&pfd, 1, HANDSHAKE_BYTE_TIMEOUT * 100) <= 0) continue;
-		try {
-			unsigned char handshake[5];
-			get(reinterpret_cast<char*>(handshake), 5);
-			
-			if(handshake[0] == 4 && handshake[1] == 0xFF && handshake[4] == (unsigned char)~4) {
-				appType = handshake[2];
-				uid = handshake[3];
-				setTimeout(0);
+static const size_t FLUSH_SIZE = 255; ///< Null bytes sent to resynchronize the device before each attempt
+static const long HANDSHAKE_REPLY_TIMEOUT = 500; ///< Milliseconds to wait for a reply once the handshake has been sent
+
+/**
+ * Initializes ArdPort device on the given special device file.
+ * @param dev path to serial port device file
+ * @param async if false, the constructor blocks until the handshake is complete; if true, it only starts the handshake,
+ * 	which continues once the port is added to an EventLoop (see class description)
+ * @throws SerialException thrown on error opening port or, unless \c async, handshaking
+ */
+ArdPort::ArdPort(const char *dev, bool async) throw (SerialException) : SerialPort(dev, BAUD_RATES[0].flag, false, true, CS8),
+	appType(0), uid(0), extendedFraming(false), handshakeState(HANDSHAKING), rejected(false), handshakeBaud(0),
+	rxBuffer(RX_BUFFER_SIZE), rxStart(0), rxEnd(0) {
+	setTimeout(0);
+	setReadMinimum(1); //reads return whatever is available; never changed again
+	if(async) {
+		setQueuedWrites(true);
+		sendHandshake();
+		return;
+	}
+
+	for(;;) {
+		sendHandshake();
+		for(;;) {
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			const long left = (handshakeDeadline.tv_sec - now.tv_sec) * 1000 + (handshakeDeadline.tv_nsec - now.tv_nsec) / 1000000;
+			struct pollfd pfd = {fdesc, POLLIN, 0};
+			if(left <= 0 || poll(&pfd, 1, left) <= 0)
+				break;
+			fillBuffer();
+			if(findHandshake()) {
+				finishHandshake();
 				return;
 			}
-		} catch(...) {}
+		}
+		if(++handshakeBaud == NUM_BAUD_RATES)
+			throw SerialException("ARD handshaking error");
 	}
-	
-	throw SerialException("ARD handshaking error");
 }
 
 ArdPort::~ArdPort() {
-	Log::msg<<"ArdPort device deleted of type 0x"<<std::hex<<(unsigned int)appType<<" and UID 0x"<<std::hex<<(unsigned int)uid<<"."<<std::endl;
+	if(handshakeState == READY)
+		Log::msg<<"ArdPort device deleted of type 0x"<<std::hex<<(unsigned int)appType<<" and UID 0x"<<std::hex<<(unsigned int)uid<<"."<<std::endl;
 }
 
-unsigned char ArdPort::getDatagram(std::string& buf) throw (SerialException)
+/**
+ * Connect a slot to be called once an asynchronous handshake finishes. The slot receives true if the device answered,
+ * in which case getAppType() and getUid() are valid, or false if it did not, in which case the port removes itself from
+ * its EventLoop. The slot may remove a successful port from its loop as well, in which case it should reject() it.
+ * @param slot slot to call
+ * @return connection to the slot
+ */
+Connection ArdPort::registerHandshakeSlot(const Signal<void (bool)>::slot_type& slot) {
+	return handshakeSignal.connect(slot);
+}
+
+/**
+ * Start a handshake attempt at the current baud rate: flush the connection, send the handshake datagram, and set the
+ * deadline for the reply. With queued writes, the flush is still being transmitted on return, so the deadline allows
+ * for it, and a wakeup is scheduled for the deadline.
+ */
+void ArdPort::sendHandshake() throw (SerialException) {
+	setSpeed(BAUD_RATES[handshakeBaud].flag); //also discards anything received at the previous rate
+	rxStart = rxEnd = 0;
+
+	char flush[FLUSH_SIZE];
+	std::memset(flush, 0, FLUSH_SIZE);
+	send(flush, FLUSH_SIZE);
+	if(!queuedWrites)
+		flushInput(); //the flush has been transmitted; discard whatever arrived meanwhile
+	sendDatagram(0xFF, NULL, 0); //no message
+
+	long wait = HANDSHAKE_REPLY_TIMEOUT;
+	if(queuedWrites)
+		wait += (FLUSH_SIZE + 3) * 10 * 1000 / BAUD_RATES[handshakeBaud].bps; //10 bits per byte
+	clock_gettime(CLOCK_MONOTONIC, &handshakeDeadline);
+	handshakeDeadline.tv_sec += wait / 1000;
+	handshakeDeadline.tv_nsec += (wait % 1000) * 1000000L;
+	if(handshakeDeadline.tv_nsec >= 1000000000L) {
+		handshakeDeadline.tv_sec++;
+		handshakeDeadline.tv_nsec -= 1000000000L;
+	}
+	if(queuedWrites)
+		scheduleWakeup(handshakeDeadline);
+}
+
+/**
+ * Look for the device's reply to the handshake in the receive buffer, skipping anything before it (e.g., noise
+ * received while the flush was transmitted). Bytes following the reply are kept.
+ * @return true if the reply was found
+ */
+bool ArdPort::findHandshake() {
+	for(; rxStart + 5 <= rxEnd; rxStart++) {
+		const unsigned char* h = reinterpret_cast<const unsigned char*>(&rxBuffer[rxStart]);
+		if(h[0] == 4 && h[1] == 0xFF && h[4] == (unsigned char)~4) {
+			appType = h[2];
+			uid = h[3];
+			rxStart += 5;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Configure the port for normal operation once the device has answered.
+ */
+void ArdPort::finishHandshake() throw (SerialException) {
+	handshakeState = READY;
+	cancelWakeup();
+	setDrain(false);
+	setQueuedWrites(true); //a full transmit buffer must not stall the event loop
+
+	//offer extended framing; the reply, if any, is handled by nextDatagram(). The offer carries no message, since
+	//firmware built on PURT's buffered receiver only survives unknown types that have none.
+	sendDatagram(0xFE, NULL, 0);
+}
+
+/**
+ * Continue an asynchronous handshake. Call from onActivity() while isHandshaking() is true.
+ * @return value for onActivity() to return
+ */
+bool ArdPort::continueHandshake() {
+	try {
+		fillBuffer();
+		if(!findHandshake())
+			return true;
+		finishHandshake();
+	} catch(std::exception& e) {
+		return failHandshake();
+	}
+	handshakeSignal(true);
+	return true;
+}
+
+/**
+ * Try the next baud rate once the reply to an asynchronous handshake is overdue.
+ * @return false once every baud rate has been tried, removing the port from its EventLoop
+ */
+bool ArdPort::onWakeup() {
+	if(handshakeState != HANDSHAKING)
+		return true;
+	if(++handshakeBaud == NUM_BAUD_RATES)
+		return failHandshake();
+	try {
+		sendHandshake();
+	} catch(std::exception& e) {
+		return failHandshake();
+	}
+	return true;
+}
+
+/**
+ * Give up on an asynchronous handshake.
+ * @return false, for the port to be removed from its EventLoop
+ */
+bool ArdPort::failHandshake() {
+	handshakeState = FAILED;
+	cancelWakeup();
+	handshakeSignal(false);
+	return false;
+}
+
+bool ArdPort::fillBuffer() throw (SerialException)
 {
-	char buffer[256];
-	unsigned char size;
-	get(reinterpret_cast<char*>(&size), 1);
+	const size_t space = detail::prepareRxBuffer(rxBuffer, rxStart, rxEnd);
+	const size_t r = getAvailable(&rxBuffer[rxEnd], space);
+	rxEnd += r;
+	return r > 0;
+}
 
-	get(buffer, size);
+bool ArdPort::nextDatagram(Datagram& d) throw (SerialException)
+{
+	for(;;) {
+		//a first byte of 0 cannot start a datagram; skip it as the devices do
+		while(rxStart < rxEnd && rxBuffer[rxStart] == 0)
+			rxStart++;
+		if(rxStart == rxEnd)
+			return false;
 
-	unsigned char type = buffer[0];
-	unsigned char size2 = ~buffer[size - 1];
-	
-	if(size != size2)
-		throw SerialException("Invalid ARD datagram");
+		const unsigned char* frame = reinterpret_cast<const unsigned char*>(&rxBuffer[rxStart]);
+		const size_t available = rxEnd - rxStart;
+		size_t frameSize;
+		if(frame[0] == 0x01) { //extended
+			size_t length;
+			const int lengthSize = detail::decodeVarint(frame + 1, available - 1, length);
+			if(lengthSize == 0)
+				return false; //incomplete
+			if(lengthSize < 0 || length > MAX_EXTENDED_MESSAGE)
+				throw SerialException("Invalid ARD datagram");
+			frameSize = 1 + lengthSize + 1 + length + 1;
+			if(available < frameSize)
+				return false; //incomplete
+			if(frame[frameSize - 1] != static_cast<unsigned char>(~length))
+				throw SerialException("Invalid ARD datagram");
+			d.type = frame[1 + lengthSize];
+			d.data = reinterpret_cast<const char*>(frame + 2 + lengthSize);
+			d.size = length;
+		} else {
+			const unsigned char size = frame[0];
+			frameSize = 1 + size;
+			if(available < frameSize)
+				return false; //incomplete
+			if(frame[size] != static_cast<unsigned char>(~size))
+				throw SerialException("Invalid ARD datagram");
+			d.type = frame[1];
+			d.data = reinterpret_cast<const char*>(frame + 2);
+			d.size = size - 2;
+		}
+		rxStart += frameSize;
 
-	buf.assign(buffer + 1, size - 2);
-	return type;
+		if(d.type != 0xFE)
+			return true;
+		//the device's answer to our offer of extended framing
+		extendedFraming = (d.size >= 1 && d.data[0] >= 1);
+	}
 }
 
-void ArdPort::sendDatagram(unsigned char type, const char *datagram, unsigned char len) throw (SerialException)
+void ArdPort::sendDatagram(unsigned char type, const char *datagram, size_t len) throw (SerialException)
 {
-	if(len > 253) //too large for next addition
+	unsigned char header[2 + detail::VARINT_MAX_BYTES];
+	size_t headerSize;
+	unsigned char check;
+	if(len <= 253) {
+		unsigned char size = len + 2; //overhead is 2 bytes (not including first size byte)
+		header[0] = size;
+		header[1] = type;
+		headerSize = 2;
+		check = ~size;
+	} else if(extendedFraming && len <= MAX_EXTENDED_MESSAGE) {
+		header[0] = 0x01;
+		headerSize = 1 + detail::encodeVarint(len, header + 1);
+		header[headerSize++] = type;
+		check = ~static_cast<unsigned char>(len);
+	} else {
 		throw SerialException("ARD datagram too large to send");
-	unsigned char size = len + 2; //overhead is 2 bytes (not including first size byte)
-	unsigned char size2 = ~size;
-	send(reinterpret_cast<char*>(&size), 1);
-
-	send(reinterpret_cast<char*>(&type), 1);
-	send(datagram,len);
-	send(reinterpret_cast<char*>(&size2), 1);
+	}
+	iovec iov[3] = {
+		{header, headerSize},
+		{const_cast<char*>(datagram), len},
+		{&check, 1}
+	};
+	send(iov, 3);
 }
 
 
@@ -27,8 +27,11 @@
 #define ARDPORT_H_
 
 #include "SerialPort.h"
+#include "Signal.h"
 #include "urtexcept.h"
+#include <ctime>
 #include <string>
+#include <vector>
 
 namespace urt {
 
@@ -39,7 +42,18 @@ namespace urt {
  * to automatically detect the attached device.
  *
  * @note ArdPort is an abstract class. It does not implement onActivity(). To use ArdPort, extend the class,
- * 	implement onActivity(), and utilize getDatagram() to retrieve the data.
+ * 	implement onActivity(), and utilize fillBuffer() and nextDatagram() to retrieve the data.
+ *
+ * Received bytes are kept in a per-port buffer. Each call to fillBuffer() reads whatever the port has available
+ * without blocking or changing the port attributes, after which nextDatagram() returns every complete datagram
+ * in turn. A datagram split across several reads is simply completed by a later fillBuffer().
+ *
+ * By default, the constructor blocks until the handshake (described below) is complete, which can take more than a
+ * second for each baud rate tried. An ArdPort constructed with \c async set instead returns at once and handshakes
+ * while its EventLoop runs, so any number of ports can handshake at the same time: the subclass's onActivity() must
+ * return continueHandshake() while isHandshaking() is true, and ArdPort's onWakeup() moves on to the next baud rate
+ * whenever a reply is overdue. The outcome is delivered to the slots connected with registerHandshakeSlot(); a port
+ * whose device never answers removes itself from the loop.
  *
  * A datagram is defined as follows:<br>
  * <tt>{length of remaining datagram: 1 byte}{message type: 1 byte}{message}{bitwise inverse of first byte: 1 byte}</tt>
@@ -57,6 +71,20 @@ namespace urt {
  * 		Device: <tt>0x04 0xFF (application type; 1 byte) (unique identifier; 1 byte) 0xFB</tt> -- a datagram of type 0xFF
  * 			with the application type and UID as the message.
  *
+ * <b>Extended framing.</b> Messages longer than 253 bytes are sent in an extended datagram:<br>
+ * <tt>0x01 {length of message: varint}{message type: 1 byte}{message}{bitwise inverse of the low byte of the length: 1 byte}</tt><br>
+ * where the length is encoded seven bits per byte, least significant first, with the high bit set on every byte but the
+ * last. Since a first byte of 1 is discarded by devices that do not understand extended datagrams, the two formats can be
+ * told apart, and an ArdPort accepts either at any time. However, extended datagrams are only sent to devices that have
+ * agreed to them: right after the handshake, the server sends <tt>0x02 0xFE 0xFD</tt>, a datagram of type 0xFE with no
+ * message. A device that understands extended datagrams replies with a legacy datagram of type 0xFE containing the
+ * highest framing version it supports (currently 1). Firmware that does not simply ignores the offer (it must have no
+ * message: PURT's buffered receiver treats the message of an unknown type as its terminator), and the port keeps sending
+ * only legacy datagrams, refusing messages that do not fit. Short messages always use the legacy format.
+ *
+ * @note No PURT or MiniURT firmware answers the offer yet, so extended datagrams are currently only exchanged with
+ * 	devices that implement them independently.
+ *
  * @note Ideally, the UID would be unique for each device of its application type so that the application type and UID combined would
  * 		uniquely identify each device. However, since programming each device with a different UID would be time-consuming, it is
  * 		possible -- in fact, suggested -- to just use 0 as the UID.
@@ -70,20 +98,49 @@ namespace urt {
 class ArdPort: public urt::SerialPort {
 public:
 	/**
-	 * Initializes ArdPort device on the given special device file.
-	 * @param dev path to serial port device file
-	 * @throws SerialException thrown on error opening port or handshaking
+	 * A received datagram. The message is not copied out of the receive buffer; it remains valid only until the next
+	 * call to fillBuffer().
 	 */
-	ArdPort(const char* dev) throw (SerialException);
+	struct Datagram {
+		unsigned char type; ///< Message type
+		const char* data; ///< Message; not null-terminated
+		size_t size; ///< Length of message in bytes
+		/** @return copy of message */
+		std::string str() const { return std::string(data, size); }
+	};
+
+	ArdPort(const char* dev, bool async = false) throw (SerialException);
 	virtual ~ArdPort();
 
 	/**
-	 * Receives a datagram.
-	 * @param buf reference to std::string in which to store the datagram
-	 * @return the datagram type
-	 * @throws SerialException thrown on error
+	 * Determine whether an asynchronous handshake is still in progress.
+	 * @return true until the device has answered or every baud rate has been tried
+	 */
+	bool isHandshaking() const { return handshakeState == HANDSHAKING; }
+	Connection registerHandshakeSlot(const Signal<void (bool)>::slot_type& slot);
+	/**
+	 * Refuse the device, typically from a handshake slot that removes the port from its EventLoop. Removal only takes
+	 * effect at the end of the loop's iteration; a rejected port handles no datagrams in the meantime, including any
+	 * that followed the handshake.
+	 */
+	void reject() { rejected = true; }
+	/** @return true if reject() was called */
+	bool isRejected() const { return rejected; }
+
+	/**
+	 * Reads all bytes currently available from the port into the receive buffer. Call from onActivity().
+	 * Invalidates any Datagram previously returned by nextDatagram().
+	 * @return true if any bytes were read
+	 * @throws SerialException thrown on error or if the port was closed
+	 */
+	bool fillBuffer() throw (SerialException);
+	/**
+	 * Extracts the next complete datagram from the receive buffer.
+	 * @param d Datagram to describe the datagram; refers to the receive buffer
+	 * @return true if a datagram was extracted; false if no complete datagram is buffered
+	 * @throws SerialException thrown if the buffered datagram is malformed
 	 */
-	unsigned char getDatagram(std::string& buf) throw (SerialException);
+	bool nextDatagram(Datagram& d) throw (SerialException);
 	/**
 	 * Sends a datagram.
 	 * @param type type of message
@@ -99,7 +156,7 @@ public:
 	 * @param len length of datagram
 	 * @throws SerialException thrown on error
 	 */
-	void sendDatagram(unsigned char type, const char* datagram, unsigned char len) throw (SerialException);
+	void sendDatagram(unsigned char type, const char* datagram, size_t len) throw (SerialException);
 	/**
 	 * Get application type reported by device.
 	 * @return application type
@@ -110,10 +167,41 @@ public:
 	 * @return UID
 	 */
     unsigned char getUid() const { return uid; }
+	/**
+	 * Determine whether the device has agreed to extended datagrams (see above). Until it does, messages longer than
+	 * 253 bytes cannot be sent.
+	 * @return true if extended datagrams may be sent
+	 */
+	bool hasExtendedFraming() const { return extendedFraming; }
+
+	static const unsigned char FRAMING_VERSION = 1; ///< Highest framing version supported
+	static const size_t MAX_EXTENDED_MESSAGE = 0xFFFF; ///< Largest message accepted or sent in an extended datagram
+
+protected:
+	bool continueHandshake();
+	bool onWakeup();
 
 private:
+	static const size_t RX_BUFFER_SIZE = 512; ///< Initial buffer size; room for one legacy datagram plus a partial one
+
+	enum HandshakeState { HANDSHAKING, READY, FAILED };
+
+	void sendHandshake() throw (SerialException);
+	bool findHandshake();
+	void finishHandshake() throw (SerialException);
+	bool failHandshake();
+
 	unsigned char appType;
 	unsigned char uid;
+	bool extendedFraming; ///< True once the device has agreed to extended datagrams
+	HandshakeState handshakeState;
+	bool rejected; ///< True once reject() was called
+	size_t handshakeBaud; ///< Index of the baud rate being tried
+	timespec handshakeDeadline; ///< When the reply to the current attempt is overdue (CLOCK_MONOTONIC)
+	Signal<void (bool)> handshakeSignal; ///< Fired when an asynchronous handshake finishes
+	std::vector<char> rxBuffer; ///< Received bytes not yet consumed lie in [rxStart, rxEnd); grows for extended datagrams
+	size_t rxStart; ///< Start of first unconsumed byte
+	size_t rxEnd; ///< End of received bytes
 
 	//prevent inadvertent use of lower-level get and send calls
 	using SerialPort::get;
@@ -20,6 +20,7 @@
 #include "EventLoop.h"
 #include "StateDevice.h"
 #include "Log.h"
+#include <boost/bind.hpp>
 
 namespace urt {
 
@@ -42,28 +43,86 @@ DeviceManager::Directory* DeviceManager::addExposedDirectory(const std::string&
 }
 
 
-void DeviceManager::execute(EventLoop& loop) {
+DeviceManager::~DeviceManager() {
+	for(std::map<StateDevice*, Probing>::iterator p = m_probing.begin(); p != m_probing.end(); p++)
+		p->second.connection.disconnect();
+}
+
+void DeviceManager::execute(EventLoop& loop, const boost::function<void ()>& done) {
 	static const boost::filesystem::directory_iterator end_itr; // default construction yields past-the-end
+	m_done = done;
 	for(std::list<Directory>::iterator d = m_directories.begin(); d != m_directories.end(); d++) {
 		for(boost::filesystem::directory_iterator i(d->m_directory); i != end_itr; ++i) {
 			if(boost::regex_match(i->leaf(), d->m_rule)) {
 				urt::Log::msg<<"Found "<<*i<<std::endl;
-				try {
-					boost::shared_ptr<StateDevice> device(new urt::StateDevice(i->string().c_str()));
-					
-					if(onFound(device)) {
-						loop.registerIntervalSlot(&urt::StateDevice::poll, *device);
-						loop.add(device);
-					} else {
-						urt::Log::err<<"Error loading "<<*i<<". Vetoed."<<std::endl;
-					}
-				} catch (std::exception& e) {
-					m_failed.push_back(i->string());
-					urt::Log::err<<"Error loading "<<*i<<". "<<e.what()<<std::endl;
-				}
+				std::string error;
+				if(!probe(i->string(), loop, error))
+					fail(i->string(), error);
 			}
 		}
 	}
+	checkDone();
+}
+
+bool DeviceManager::probe(const std::string& path, EventLoop& loop, std::string& error, bool retry) {
+	boost::shared_ptr<StateDevice> device;
+	try {
+		device.reset(new urt::StateDevice(path.c_str(), true));
+	} catch (std::exception& e) {
+		error = e.what();
+		return false;
+	}
+	if(!loop.add(device)) {
+		error = "cannot add to EventLoop";
+		return false;
+	}
+	
+	Probing& p = m_probing[device.get()];
+	p.device = device;
+	p.connection = device->registerHandshakeSlot(boost::bind(&DeviceManager::onHandshake, this, device.get(), &loop, _1));
+	p.retry = retry;
+	return true;
+}
+
+void DeviceManager::onHandshake(StateDevice* d, EventLoop* loop, bool success) {
+	std::map<StateDevice*, Probing>::iterator p = m_probing.find(d);
+	if(p == m_probing.end())
+		return;
+	const boost::shared_ptr<StateDevice> device = p->second.device;
+	const bool retry = p->second.retry;
+	m_probing.erase(p);
+	
+	if(!success) {
+		if(retry)
+			retryLater(device->getPath());
+		else
+			fail(device->getPath(), "ARD handshaking error");
+	} else if(onFound(device)) {
+		loop->registerIntervalSlot(&urt::StateDevice::poll, *device);
+	} else {
+		urt::Log::err<<"Error loading "<<device->getPath()<<". Vetoed."<<std::endl;
+		device->reject(); //removal is deferred; keep it from handling datagrams until then
+		loop->remove(device.get());
+	}
+	checkDone();
+}
+
+void DeviceManager::fail(const std::string& path, const std::string& why) {
+	m_failed.push_back(path);
+	urt::Log::err<<"Error loading "<<path<<". "<<why<<std::endl;
+	onFailed(path);
+}
+
+void DeviceManager::retryLater(const std::string& path) {
+	fail(path, "ARD handshaking error");
+}
+
+void DeviceManager::checkDone() {
+	if(m_probing.empty() && m_done) {
+		boost::function<void ()> done;
+		done.swap(m_done);
+		done();
+	}
 }
 
 }
@@ -19,10 +19,13 @@
 #ifndef DEVICEMANAGER_H_
 #define DEVICEMANAGER_H_
 
+#include "Signal.h"
 #include <string>
 #include <list>
+#include <map>
 #include <stdexcept>
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 #include <boost/regex.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -37,16 +40,26 @@ class StateDevice;
  *
  * The DeviceManager searches given directories for device files that
  * match a given regular expression rule. Upon a match, a new StateDevice
- * object is created and added to a given EventLoop; additionally, its poll() is
- * connected to the EventLoop's interval signal.
+ * object is created and added to a given EventLoop, where it handshakes
+ * asynchronously (see ArdPort); every matching device handshakes at the same
+ * time, so finding them all takes no longer than finding the slowest. Once a
+ * device answers, its poll() is connected to the EventLoop's interval signal.
  *
  * For further control of the StateDevice, extend this class and override the virtual
- * onFound(). Returning false from that function will veto the StateDevice and destroy it,
- * provided you do not keep or copy the boost::shared_ptr passed as a parameter. One example
- * use of this function is to attach motor-related substates to the StateDevice's sendSubstate().
+ * onFound(), called once the handshake succeeds. Returning false from that function will veto
+ * the StateDevice, removing it from the EventLoop and destroying it, provided you do not keep or
+ * copy the boost::shared_ptr passed as a parameter. One example use of this function is to attach
+ * motor-related substates to the StateDevice's sendSubstate(). Devices that cannot be opened or
+ * do not answer are added to getFailed() and passed to onFailed().
+ *
+ * @note Handshakes finish while the EventLoop runs, so the DeviceManager must outlive them
+ * 	(see isProbing()); destroying it earlier leaves the devices in the loop but calls neither
+ * 	onFound() nor onFailed().
  */
 class DeviceManager {
 public:
+	virtual ~DeviceManager();
+
 	/**
 	  * Add a new directory to be searched with regex rule against which to match filenames.
 	  * Does not immediately search for devices; call execute() after adding all directories
@@ -58,19 +71,34 @@ public:
 	  */
 	virtual bool addDirectory(const std::string& dir, const std::string& rule);
 	/**
-	  * Execute search using given rules.
+	  * Execute search using given rules. Returns once every matching device has been opened;
+	  * the handshakes finish while the EventLoop runs.
 	  * @param loop EventLoop to which to add found devices.
+	  * @param done If set, called once no device is handshaking any longer, e.g., to stop the loop
+	  * 	so the program can examine getFailed(). Called before returning if no device is handshaking.
 	  * @note Do not call more than once!
 	  */
-	void execute(EventLoop& loop);
+	void execute(EventLoop& loop, const boost::function<void ()>& done = boost::function<void ()>());
 	
 	/**
-	  * Virtual function called upon finding a matching device file and after creating
-	  * a StateDevice object for it. Does nothing by default.
-	  * @param device The newly created StateDevice.
-	  * @return False to veto object (destroying it without adding to event loop). True otherwise.
+	  * Virtual function called once a StateDevice created for a matching device file has
+	  * completed its handshake. Does nothing by default.
+	  * @param device The newly created StateDevice, already in the EventLoop.
+	  * @return False to veto object (removing it from event loop and destroying it). True otherwise.
 	  */
 	virtual bool onFound(boost::shared_ptr<StateDevice> device) { return true; }
+	/**
+	  * Virtual function called after a matching device file failed to open or handshake and
+	  * has been added to getFailed(). Does nothing by default.
+	  * @param path path of the device file
+	  */
+	virtual void onFailed(const std::string& path) {}
+	
+	/**
+	  * Determine whether any device is still handshaking.
+	  * @return True until every device found so far has either answered or failed.
+	  */
+	bool isProbing() const { return !m_probing.empty(); }
 	
 	/**
 	  * Gets a list of the paths for all devices that failed to handshake.
@@ -99,10 +127,30 @@ protected:
 	Directory* addExposedDirectory(const std::string& dir, const std::string& rule);
 	
 	void addFailed(const std::string& s) { m_failed.push_back(s); }
+	
+	//Opens a StateDevice and adds it to the loop to handshake. Returns false, setting error, if the
+	//device cannot be opened. If retry is set, a failed handshake is passed to retryLater().
+	bool probe(const std::string& path, EventLoop& loop, std::string& error, bool retry = false);
+	//Logs a failed device, adds it to getFailed(), and calls onFailed().
+	void fail(const std::string& path, const std::string& why);
+	//Called when a handshake started with retry fails. Calls fail() by default.
+	virtual void retryLater(const std::string& path);
 
 private:
+	/** A StateDevice that is still handshaking. */
+	struct Probing {
+		boost::shared_ptr<StateDevice> device;
+		Connection connection; ///< To onHandshake()
+		bool retry; ///< Call retryLater() rather than fail() if the handshake fails
+	};
+	
+	void onHandshake(StateDevice* device, EventLoop* loop, bool success);
+	void checkDone();
+	
 	std::list<Directory> m_directories;
 	std::list<std::string> m_failed;
+	std::map<StateDevice*, Probing> m_probing;
+	boost::function<void ()> m_done; ///< Passed to execute(); called once nothing is probing
 };
 
 }
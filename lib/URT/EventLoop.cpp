@@ -19,19 +19,117 @@
 #include "EventLoop.h"
 #include "FDEvtSource.h"
 #include "Log.h"
+#include "State.h"
 #include <typeinfo>
 #include <poll.h>
-#include <algorithm>
-#include <set> //required for std::greater<>() comparator generator
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
 
 using namespace urt;
 
+static const int MAX_EPOLL_EVENTS = 64; ///< Maximum number of ready sources fetched per epoll_wait()
 
-EventLoop::EventLoop(int timeout) : timeout(timeout), adjustedTimeout(timeout), running(false) {
+/** @return true if \c a is strictly before \c b */
+static inline bool earlier(const timespec& a, const timespec& b)
+{
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+EventLoop::EventLoop(int timeout, Engine engine) : timeout(timeout), engine(engine), epollfd(-1), adjustedTimeout(timeout), stateBatching(false), running(false), stopping(false),
+	runUntilStopped(false), postSignalled(0), postReadable(false) {
 	timeLastInterval.tv_sec = 0;
 	timeLastInterval.tv_nsec = 0;
+
+	postfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(postfd == -1)
+		Log::warning("unable to create eventfd; tasks posted to EventLoop will wait for the next iteration");
+
+	if(engine == EPOLL) {
+		epollfd = epoll_create1(EPOLL_CLOEXEC);
+		if(epollfd == -1) {
+			Log::warning("unable to create epoll instance; EventLoop falling back to poll engine");
+			this->engine = POLL;
+		}
+	}
+	if(this->engine == EPOLL && postfd != -1) {
+		epoll_event e;
+		e.events = EPOLLIN;
+		e.data.ptr = NULL; //distinguishes postfd from sources
+		epoll_ctl(epollfd, EPOLL_CTL_ADD, postfd, &e);
+	}
+}
+EventLoop::~EventLoop() {
+	//Release the sources while the rest of the loop is still intact. They are detached first, so a source that
+	//schedules a wakeup or queues a write from its destructor, or outlives the loop through another shared_ptr, no
+	//longer refers to it; the registry is emptied before any is destroyed, so none can reach another through it.
+	for(Registry::iterator i = registry.begin(); i != registry.end(); i++)
+	{
+		i->second.source->evtloop = NULL;
+		i->second.source->wakeupIndex = FDEvtSource::WAKEUP_IDLE;
+	}
+	wakeups.clear();
+	fds.clear();
+	pollRegistrations.clear();
+	Registry sources;
+	sources.swap(registry);
+	sources.clear();
+
+	if(epollfd != -1)
+		close(epollfd);
+	if(postfd != -1)
+		close(postfd);
+}
+
+/**
+ * Run a task on the loop's thread during its next iteration. Unlike every other member, this may be called from any
+ * thread, and it never blocks. Tasks posted from one thread run in the order posted. A task that throws a
+ * std::exception is logged and discarded.
+ * @param task task to run
+ */
+void EventLoop::post(const Task& task)
+{
+	posted.push(task);
+	int expected = 0;
+	if(postfd != -1 && __atomic_compare_exchange_n(&postSignalled, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	{
+		const uint64_t one = 1;
+		while(write(postfd, &one, sizeof(one)) == -1 && errno == EINTR);
+	}
+}
+
+/**
+ * Run every posted task, draining postfd if the last wait found it readable. The flag is only cleared once the
+ * signal has been drained: a post() whose write() has not landed yet leaves it set, so its signal is drained on a
+ * later iteration rather than left pending with the flag clear, which would wake every wait immediately.
+ */
+void EventLoop::runPosted()
+{
+	if(postReadable)
+	{
+		postReadable = false;
+		uint64_t count;
+		while(read(postfd, &count, sizeof(count)) == -1 && errno == EINTR);
+		//from here on, post() signals again; anything posted before is run below
+		__atomic_store_n(&postSignalled, 0, __ATOMIC_SEQ_CST);
+	}
+
+	Task task;
+	while(posted.pop(task))
+	{
+		try
+		{
+			task();
+		}
+		catch(std::exception& e)
+		{
+			Log::error(std::string("task posted to EventLoop threw: ") + e.what());
+		}
+		task.clear();
+	}
 }
-//EventLoop::~EventLoop() {}
 
 /**
  * Start processing events.
@@ -39,97 +137,439 @@ EventLoop::EventLoop(int timeout) : timeout(timeout), adjustedTimeout(timeout),
 void EventLoop::run()
 {
 	running = true;
-	while(!fds.empty())
+	while((!registry.empty() || runUntilStopped) && !stopping)
+	{
+		//the batch is committed explicitly rather than by a destructor, so that a slot throwing at commit cannot
+		//terminate the program; commit() logs and discards such exceptions
+		const bool batching = stateBatching;
+		if(batching)
+			State::beginBatch();
+		try
+		{
+			iterate();
+		}
+		catch(...)
+		{
+			if(batching)
+				State::commit();
+			throw;
+		}
+		if(batching)
+			State::commit();
+	}
+	running = false;
+	stopping = false;
+}
+
+/**
+ * Run one iteration of the loop: wait for activity, dispatch it, and run wakeups, posted tasks, queued additions and
+ * removals, and the interval signal.
+ */
+void EventLoop::iterate()
+{
+	//sleep until the interval handler or the earliest wakeup is due, whichever comes first
+	timespec wait;
+	wait.tv_sec = adjustedTimeout / 1000;
+	wait.tv_nsec = (adjustedTimeout % 1000) * 1000000L;
+	if(!wakeups.empty())
 	{
-		if(poll(&fds[0], fds.size(), adjustedTimeout) > 0)
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const timespec& due = wakeups.front()->wakeupTime;
+		if(!earlier(now, due))
+		{
+			wait.tv_sec = 0;
+			wait.tv_nsec = 0;
+		}
+		else
 		{
-			for(std::vector<pollfd>::iterator i = fds.begin(); i < fds.end(); i++)
+			timespec left = {due.tv_sec - now.tv_sec, due.tv_nsec - now.tv_nsec};
+			if(left.tv_nsec < 0)
 			{
-				if(i->revents & (POLLIN | POLLERR | POLLHUP | POLLRDHUP))
-					if(!fdsources[i - fds.begin()]->onActivity())
-						deleteQueue.push_back(i - fds.begin());
+				left.tv_sec--;
+				left.tv_nsec += 1000000000L;
 			}
+			if(earlier(left, wait))
+				wait = left;
 		}
+	}
+
+	if(engine == EPOLL)
+		waitEpoll(wait);
+	else
+		waitPoll(wait);
+	fireWakeups();
+	runPosted();
+
+	//safe to remove sources. take care of queue now
+	for(std::vector<FDEvtSource*>::iterator i = deleteQueue.begin(); i < deleteQueue.end(); i++)
+	{
+		Registry::iterator r = registry.find(*i);
+		if(r != registry.end())
+			erase(r);
+	}
+	deleteQueue.clear();
 
-		//safe to remove from fds. take care of queue now
-		std::sort(deleteQueue.begin(), deleteQueue.end(), std::greater<size_t>());
-		for(std::vector<size_t>::iterator i = deleteQueue.begin(); i < deleteQueue.end(); i++)
+	//safe to add sources
+	while(!addQueue.empty())
+	{
+		Registry::iterator r = registry.find(addQueue.front());
+		addQueue.pop();
+		//it may have been removed before it ever got the chance to be watched
+		if(r != registry.end() && !r->second.attached && !attach(r->second))
+			registry.erase(r);
+	}
+
+	//check to see if time to call interval handler; adjust adjustedTimeout
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long diff = (now.tv_sec - timeLastInterval.tv_sec)*(long long)1000 + (now.tv_nsec - timeLastInterval.tv_nsec)/1000000;
+	if(diff >= timeout)
+	{
+		intervalSignal();
+		adjustedTimeout = timeout;
+		clock_gettime(CLOCK_MONOTONIC, &timeLastInterval);
+	}
+	else
+	{
+		adjustedTimeout = timeout - diff;
+		if(adjustedTimeout < 0)
+			adjustedTimeout = 0;
+
+	}
+}
+
+/**
+ * Wait for and dispatch activity using ppoll(). Every watched descriptor is scanned.
+ * @param wait maximum time to wait
+ */
+void EventLoop::waitPoll(const timespec& wait)
+{
+	//watch postfd as well, at the end, only for the duration of the call
+	const size_t count = fds.size();
+	if(postfd != -1)
+	{
+		const pollfd p = {postfd, POLLIN, 0};
+		fds.push_back(p);
+	}
+	const int ready = ppoll(fds.empty() ? NULL : &fds[0], fds.size(), &wait, NULL);
+	if(ready > 0 && postfd != -1 && fds[count].revents)
+		postReadable = true;
+	fds.resize(count);
+	if(ready > 0)
+	{
+		//fds cannot change size here; additions and removals are queued while running
+		for(size_t i = 0; i < count; i++)
 		{
-			//Note, this relies on the fact that the deleteQueue will be sorted (so we can remove in descending order,
-			//avoiding changing the following indexes).
-			Log::msg<<typeid(**(fdsources.begin() + *i)).name()<<" deleted"<<std::endl;
-			fds.erase(fds.begin() + *i);
-			fdsources.erase(fdsources.begin() + *i);
+			const short revents = fds[i].revents;
+			if(revents)
+				dispatch(*pollRegistrations[i], revents & (POLLIN | POLLERR | POLLHUP | POLLRDHUP), revents & POLLOUT);
 		}
-		deleteQueue.clear();
+	}
+}
+
+/**
+ * Wait for and dispatch activity using epoll. Only ready sources are visited.
+ * epoll_wait() only has millisecond resolution, so waits shorter than a millisecond are done by ppoll()ing the epoll
+ * descriptor itself. Longer waits are rounded down; the remainder is picked up on the next iteration.
+ * @param wait maximum time to wait
+ */
+void EventLoop::waitEpoll(const timespec& wait)
+{
+	int millis = wait.tv_sec * 1000 + wait.tv_nsec / 1000000;
+	if(millis == 0 && wait.tv_nsec > 0)
+	{
+		pollfd p = {epollfd, POLLIN, 0};
+		if(ppoll(&p, 1, &wait, NULL) <= 0)
+			return;
+	}
 
-		//safe to add sources
-		while(!addQueue.empty())
+	epoll_event events[MAX_EPOLL_EVENTS];
+	const int n = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, millis);
+	for(int i = 0; i < n; i++)
+	{
+		//Registrations are not erased while dispatching, so the pointer is still valid.
+		if(!events[i].data.ptr)
 		{
-			fdsources.push_back(addQueue.front());
-			pollfd t = {addQueue.front()->fdesc, POLLIN | POLLRDHUP, 0};
-			fds.push_back(t);
-			addQueue.pop();
+			postReadable = true; //posted tasks are run after dispatching
+			continue;
 		}
+		const uint32_t e = events[i].events;
+		dispatch(*static_cast<Registration*>(events[i].data.ptr), e & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP), e & EPOLLOUT);
+	}
+}
 
-		//check to see if time to call interval handler; adjust adjustedTimeout
-		timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		long long diff = (now.tv_sec - timeLastInterval.tv_sec)*(long long)1000 + (now.tv_nsec - timeLastInterval.tv_nsec)/1000000;
-		if(diff >= timeout)
+/**
+ * Call a source's handlers, queuing it for removal if it asks to be deregistered or its queued output cannot be written.
+ * Sources already queued for removal are skipped.
+ * @param r registration of source with activity
+ * @param readable true if the source has input or an error to handle
+ * @param writable true if the source's queued output can be written
+ */
+void EventLoop::dispatch(Registration& r, bool readable, bool writable)
+{
+	if(r.removing)
+		return;
+	if((writable && !r.source->flushWrites()) || (readable && !r.source->onActivity()))
+	{
+		r.removing = true;
+		deleteQueue.push_back(r.source.get());
+	}
+}
+
+/**
+ * Start or stop watching a source for writability. Called by the source as its outbound queue fills and empties.
+ * Safe to call while dispatching.
+ * @param source source whose interest changed
+ * @param writable true to watch for writability
+ */
+void EventLoop::setWriteInterest(FDEvtSource* source, bool writable)
+{
+	Registry::iterator i = registry.find(source);
+	if(i == registry.end() || !i->second.attached || source->fdesc < 0)
+		return;
+
+	Registration& r = i->second;
+	if(engine == EPOLL)
+	{
+		epoll_event e;
+		e.events = EPOLLIN | EPOLLRDHUP;
+		if(source->edgeTriggered)
+			e.events |= EPOLLET;
+		if(writable)
+			e.events |= EPOLLOUT;
+		e.data.ptr = &r;
+		epoll_ctl(epollfd, EPOLL_CTL_MOD, source->fdesc, &e);
+	}
+	else
+	{
+		if(writable)
+			fds[r.pollIndex].events |= POLLOUT;
+		else
+			fds[r.pollIndex].events &= ~POLLOUT;
+	}
+}
+
+/**
+ * Fire every wakeup that is due. Sources whose wakeup is rescheduled or cancelled by an earlier handler in the same
+ * pass are skipped; a source that reschedules itself for a time already passed is woken on the next iteration.
+ */
+void EventLoop::fireWakeups()
+{
+	if(wakeups.empty())
+		return;
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while(!wakeups.empty() && !earlier(now, wakeups.front()->wakeupTime))
+	{
+		FDEvtSource* s = wakeups.front();
+		removeWakeup(s);
+		s->wakeupIndex = FDEvtSource::WAKEUP_DUE;
+		dueWakeups.push_back(s);
+	}
+
+	for(std::vector<FDEvtSource*>::iterator i = dueWakeups.begin(); i < dueWakeups.end(); i++)
+	{
+		FDEvtSource* s = *i;
+		if(s->wakeupIndex != FDEvtSource::WAKEUP_DUE)
+			continue;
+		s->wakeupIndex = FDEvtSource::WAKEUP_IDLE;
+		s->wakeupRequested = false;
+
+		Registry::iterator r = registry.find(s);
+		if(r != registry.end() && !r->second.removing && !s->onWakeup())
 		{
-			intervalSignal();
-			adjustedTimeout = timeout;
-			clock_gettime(CLOCK_MONOTONIC, &timeLastInterval);
+			r->second.removing = true;
+			deleteQueue.push_back(s);
 		}
-		else
+	}
+	dueWakeups.clear();
+}
+
+/**
+ * Put a source into the wakeup heap according to its wakeupTime, or move it if it is already there.
+ * @param source source whose wakeup to schedule
+ */
+void EventLoop::insertWakeup(FDEvtSource* source)
+{
+	const size_t i = source->wakeupIndex;
+	if(i < wakeups.size() && wakeups[i] == source)
+	{
+		siftWakeupUp(i);
+		siftWakeupDown(source->wakeupIndex);
+	}
+	else
+	{
+		wakeups.push_back(source);
+		siftWakeupUp(wakeups.size() - 1);
+	}
+}
+
+/**
+ * Take a source out of the wakeup heap. Does nothing if it is not there.
+ * @param source source whose wakeup to cancel
+ */
+void EventLoop::removeWakeup(FDEvtSource* source)
+{
+	const size_t i = source->wakeupIndex;
+	if(i < wakeups.size() && wakeups[i] == source)
+	{
+		FDEvtSource* last = wakeups.back();
+		wakeups.pop_back();
+		if(i < wakeups.size())
 		{
-			adjustedTimeout = timeout - diff;
-			if(adjustedTimeout < 0)
-				adjustedTimeout = 0;
+			wakeups[i] = last;
+			last->wakeupIndex = i;
+			siftWakeupUp(i);
+			siftWakeupDown(last->wakeupIndex);
+		}
+	}
+	source->wakeupIndex = FDEvtSource::WAKEUP_IDLE;
+}
 
+void EventLoop::siftWakeupUp(size_t i)
+{
+	FDEvtSource* s = wakeups[i];
+	while(i > 0)
+	{
+		const size_t parent = (i - 1) / 2;
+		if(!earlier(s->wakeupTime, wakeups[parent]->wakeupTime))
+			break;
+		wakeups[i] = wakeups[parent];
+		wakeups[i]->wakeupIndex = i;
+		i = parent;
+	}
+	wakeups[i] = s;
+	s->wakeupIndex = i;
+}
+
+void EventLoop::siftWakeupDown(size_t i)
+{
+	FDEvtSource* s = wakeups[i];
+	const size_t n = wakeups.size();
+	while(2 * i + 1 < n)
+	{
+		size_t child = 2 * i + 1;
+		if(child + 1 < n && earlier(wakeups[child + 1]->wakeupTime, wakeups[child]->wakeupTime))
+			child++;
+		if(!earlier(wakeups[child]->wakeupTime, s->wakeupTime))
+			break;
+		wakeups[i] = wakeups[child];
+		wakeups[i]->wakeupIndex = i;
+		i = child;
+	}
+	wakeups[i] = s;
+	s->wakeupIndex = i;
+}
+
+/**
+ * Start watching a registered source with the engine in use and arm any wakeup it requested beforehand.
+ * Sources with a negative file descriptor are not given to the engine. Should only be called when not dispatching.
+ * @param r registration of source to watch
+ * @return false if the engine refused the file descriptor
+ */
+bool EventLoop::attach(Registration& r)
+{
+	if(r.source->fdesc < 0)
+	{
+		//nothing to watch; wakeups only
+	}
+	else if(engine == EPOLL)
+	{
+		epoll_event e;
+		e.events = EPOLLIN | EPOLLRDHUP;
+		if(r.source->edgeTriggered)
+			e.events |= EPOLLET;
+		if(r.source->getQueuedBytes())
+			e.events |= EPOLLOUT;
+		e.data.ptr = &r;
+		if(epoll_ctl(epollfd, EPOLL_CTL_ADD, r.source->fdesc, &e) == -1)
+		{
+			Log::err<<"Unable to watch "<<typeid(*r.source).name()<<" with epoll"<<std::endl;
+			return false;
 		}
 	}
-	running = false;
+	else
+	{
+		r.pollIndex = fds.size();
+		pollfd t = {r.source->fdesc, static_cast<short>(POLLIN | POLLRDHUP | (r.source->getQueuedBytes() ? POLLOUT : 0)), 0};
+		fds.push_back(t);
+		pollRegistrations.push_back(&r);
+	}
+	r.attached = true;
+	r.source->evtloop = this;
+	if(r.source->wakeupRequested)
+		insertWakeup(r.source.get());
+	return true;
 }
 
 /**
- * Get the internal index given to an FDEvtSource. Should only be called internally.
- * @note Only compares address of FDEvtSource, not actual attributes.
- * @param fdsource pointer to FDEvtSource to check
- * @return index of FDEvtSource or number of FDEvtSources registered if not found
+ * Stop watching a source with the engine in use. Should only be called when not dispatching.
+ * @param r registration of source to stop watching
  */
-size_t EventLoop::indexFDSource(FDEvtSource* fdsource)
+void EventLoop::detach(Registration& r)
 {
-	for(std::vector<boost::shared_ptr<FDEvtSource> >::iterator i = fdsources.begin(); i < fdsources.end(); i++)
-		if(i->get() == fdsource)
-			return i - fdsources.begin();
-	return fdsources.size();
+	if(!r.attached)
+		return;
+	removeWakeup(r.source.get());
+	r.source->evtloop = NULL;
+	if(r.source->fdesc < 0)
+	{
+		//was never given to the engine
+	}
+	else if(engine == EPOLL)
+	{
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, r.source->fdesc, NULL);
+	}
+	else
+	{
+		//move the last entry into the vacated slot so removal does not shift the vectors
+		const size_t i = r.pollIndex;
+		fds[i] = fds.back();
+		pollRegistrations[i] = pollRegistrations.back();
+		pollRegistrations[i]->pollIndex = i;
+		fds.pop_back();
+		pollRegistrations.pop_back();
+	}
+	r.attached = false;
 }
+
+/**
+ * Stop watching a source and release the EventLoop's ownership of it. Should only be called when not dispatching.
+ * @param i registry entry to erase
+ */
+void EventLoop::erase(Registry::iterator i)
+{
+	Log::msg<<typeid(*i->second.source).name()<<" deleted"<<std::endl;
+	detach(i->second);
+	registry.erase(i);
+}
+
 /**
  * Add an FDEvtSource to event loop.
  * The EventLoop does not take ownership of the FDEvtSource; rather, it shares it with all other shared_ptr owners. Consequently
  * the object will not automatically be deleted when appropriate unless no other shared_ptrs exist.
  * @param fdsource pointer to FDEvtSource to add
- * @return false if particular FDEvtSource (not necessarily file descriptor) already added
+ * @return false if particular FDEvtSource (not necessarily file descriptor) already added or if it cannot be watched
  */
 bool EventLoop::add(const boost::shared_ptr<FDEvtSource>& fdsource)
 {
-	if(indexFDSource(fdsource.get()) == fdsources.size())
+	Registration t = {fdsource, 0, false, false};
+	std::pair<Registry::iterator, bool> r = registry.insert(std::make_pair(fdsource.get(), t));
+	if(!r.second)
+		return false;
+
+	if(running)
 	{
-		if(running)
-		{
-			addQueue.push(fdsource);
-		}
-		else
-		{
-			fdsources.push_back(fdsource);
-			pollfd t = {fdsource->fdesc, POLLIN | POLLRDHUP, 0};
-			fds.push_back(t);
-		}
-		return true;
+		addQueue.push(fdsource.get());
 	}
-	return false;
+	else if(!attach(r.first->second))
+	{
+		registry.erase(r.first);
+		return false;
+	}
+	return true;
 }
 
 /**
@@ -141,18 +581,20 @@ bool EventLoop::add(const boost::shared_ptr<FDEvtSource>& fdsource)
  */
 bool EventLoop::remove(FDEvtSource* fdsource)
 {
-	size_t i = indexFDSource(fdsource);
-	if(i < fdsources.size())
+	Registry::iterator i = registry.find(fdsource);
+	if(i != registry.end())
 	{
 		if(running) //can't remove while running, add to queue to delete later
 		{
-			deleteQueue.push_back(i);
+			if(!i->second.removing)
+			{
+				i->second.removing = true;
+				deleteQueue.push_back(fdsource);
+			}
 		}
 		else
 		{
-			Log::msg<<typeid(**(fdsources.begin() + i)).name()<<" deleted"<<std::endl;
-			fds.erase(fds.begin() + i);
-			fdsources.erase(fdsources.begin() + i);
+			erase(i);
 		}
 		return true;
 	}
@@ -166,9 +608,9 @@ bool EventLoop::remove(FDEvtSource* fdsource)
  */
 bool EventLoop::has(FDEvtSource* fdsource)
 {
-	return indexFDSource(fdsource) < fdsources.size();
+	return registry.find(fdsource) != registry.end();
 }
 
-void EventLoop::registerIntervalSlot(const boost::signal<void ()>::slot_type& slot) {
-	intervalSignal.connect(slot);
+Connection EventLoop::registerIntervalSlot(const Signal<void ()>::slot_type& slot) {
+	return intervalSignal.connect(slot);
 }
@@ -23,8 +23,11 @@
 #include <queue>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
-#include <boost/signal.hpp>
+#include "Signal.h"
+#include "MpscQueue.h"
 #include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <poll.h>
 #include <ctime>
@@ -34,6 +37,12 @@
 /** Convenience definition. boost::weak_ptr is used to track a watched FDEvtSource from inside */
 #define LockedEvtSourcePtr boost::shared_ptr
 
+/** Engine used by EventLoops constructed without an explicit one. Define as EPOLL (e.g., -DURT_DEFAULT_ENGINE=EPOLL)
+ *  to make the epoll engine the default. */
+#ifndef URT_DEFAULT_ENGINE
+#define URT_DEFAULT_ENGINE POLL
+#endif
+
 namespace urt
 {
 	class FDEvtSource;
@@ -44,18 +53,57 @@ namespace urt
 	 *
 	 *  @note The event loop takes ownership of any attached event sources; it will delete them when appropriate. Therefore,
 	 *  \b never create a source on the stack. Always use the \c new operator.
+	 *
+	 *  Two engines are available to wait for activity. The POLL engine uses poll() and, as such, scans every attached source
+	 *  on each wakeup. The EPOLL engine uses the Linux epoll facility and only dispatches the sources that are actually ready,
+	 *  making it preferable when many sources are attached. It also honors FDEvtSource::edgeTriggered. Sources are kept in a
+	 *  hashed registry under either engine, so add(), remove(), and has() take constant time.
+	 *
+	 *  Wakeups requested by sources (see FDEvtSource::scheduleWakeup) are kept in a binary min-heap ordered by due time, so
+	 *  scheduling and cancelling take logarithmic time and the time until the next wakeup is known in constant time. The
+	 *  loop sleeps until either activity occurs or the earliest wakeup is due, with sub-millisecond precision.
+	 *
+	 *  A source is only watched for writability while it has queued output (see FDEvtSource::queueWrite), so idle sources
+	 *  never cause spurious wakeups.
+	 *
+	 *  Like the rest of URT, an EventLoop and its sources may only be used from the thread running it, with one exception:
+	 *  post() may be called from any thread to run a task on the loop's thread. Posted tasks are pushed onto a lock-free
+	 *  queue and run once per iteration; an eventfd, written only when the queue goes from idle to non-empty, wakes the
+	 *  loop. This is how worker threads deliver results (to State, for example) without any locking.
 	 */
 	class EventLoop
 	{
 		public:
+			/** Mechanism used to wait for activity on the attached sources. */
+			enum Engine {
+				POLL,	///< Portable poll(); every source is scanned on each wakeup.
+				EPOLL	///< Linux epoll; only ready sources are visited. Supports edge-triggered sources.
+			};
+
 			/**
 			 * Create an EventLoop.
 			 * @param timeout Approximately every \c timeout milliseconds, the event handler signal will be activated.
+			 * @param engine mechanism used to wait for activity; if the EPOLL engine cannot be initialized, the EventLoop
+			 * 	falls back to POLL and logs a warning
 			 */
-			EventLoop(int timeout = 10000);
-			//~EventLoop();
+			EventLoop(int timeout = 10000, Engine engine = URT_DEFAULT_ENGINE);
+			~EventLoop();
 
 			void run();
+			/**
+			 * Make run() return once the current iteration is complete, leaving every source attached. run() may be
+			 * called again later. Must be called from the thread running the loop, e.g., from a handler.
+			 */
+			void stop() { stopping = true; }
+			/** Work posted to a loop; see post(). */
+			typedef boost::function<void ()> Task;
+			void post(const Task& task);
+			/**
+			 * Set whether run() keeps running, waiting for posted tasks, once no sources remain. If so, run() only
+			 * returns when stop() is called. Disabled by default.
+			 * @param v true to run until stopped
+			 */
+			void setRunUntilStopped(bool v) { runUntilStopped = v; }
 			bool add(const boost::shared_ptr<FDEvtSource>& fdsource);
 			/** Add an FDEvtSource to event loop.
 			 * The EventLoop takes ownership of the FDEvtSource; it will delete the source when appropriate. As a result,
@@ -83,6 +131,19 @@ namespace urt
 			}
 			bool remove(FDEvtSource* fdsource);
 			bool has(FDEvtSource* fdsource);
+			/**
+			 * Get the engine in use.
+			 * @return engine in use, which may differ from the one requested at construction if it was unavailable
+			 */
+			Engine getEngine() const { return engine; }
+			/**
+			 * Set whether each iteration of the loop is wrapped in a State batch (see State::beginBatch()).
+			 * When enabled, State slots triggered by any number of changes made while handling one round of
+			 * activity, wakeups, and the interval signal are called once per substate, with its latest value, at the
+			 * end of the iteration. Disabled by default.
+			 * @param v true to batch State changes per iteration
+			 */
+			void setStateBatching(bool v) { stateBatching = v; }
 
 			/**
 			 * Registers all slots except for non-static class member functions.
@@ -91,10 +152,11 @@ namespace urt
 			 * @param slot pointer to non-member function, functor (object that overloads operator()),
 			 * 	or static member function
 			 *
-			 * @note If the slot is a functor, it cannot be derived from boost::signals::trackable.
+			 * @note Functors are copied and never tracked. For automatic disconnection, use the member function overload.
+			 * @return connection, which may be used to unregister the slot
 			 * @see State::registerSlot
 			 */
-			void registerIntervalSlot(const boost::signal<void ()>::slot_type& slot);
+			Connection registerIntervalSlot(const Signal<void ()>::slot_type& slot);
 			/**
 			 * Registers class member functions with associated object as a slot.
 			 * The slot is called at least every timeout duration. The slot will be automatically unregistered if the
@@ -102,39 +164,76 @@ namespace urt
 			 *
 			 * @param ptrMemFunc pointer to a member function
 			 * @param obj object whose function to call
-			 * @tparam T type of object to associate with slot
+			 * @tparam T type of object to associate with slot; must be derived from Trackable
+			 * @return connection, which may be used to unregister the slot
 			 *
 			 * @see State::registerSlot
 			 */
 			template<class T>
-			inline void registerIntervalSlot(void (T::*ptrMemFunc)(), T& obj) {
-				//The reason for casting to boost::signals::trackable and back to T is to enforce
-				//the requirement that T be derived from boost::signals::trackable.
-				//If you get an error here, it is because you are trying to violate that requirement.
-				registerIntervalSlot(boost::bind(ptrMemFunc, &static_cast<T&>(static_cast<boost::signals::trackable&>(obj))));
+			inline Connection registerIntervalSlot(void (T::*ptrMemFunc)(), T& obj) {
+				return intervalSignal.connect(ptrMemFunc, obj);
 			}
 			/**
 			 * Convenience function which enables using a boost::weak_ptr (EvtSourcePtr) instead of a reference.
 			 * @overload
 			 */
 			template<class T>
-			inline void registerIntervalSlot(void (T::*ptrMemFunc)(), boost::weak_ptr<T> ptr) {
+			inline Connection registerIntervalSlot(void (T::*ptrMemFunc)(), boost::weak_ptr<T> ptr) {
 				if(boost::shared_ptr<T> p = ptr.lock())
-					registerIntervalSlot(ptrMemFunc, *p);
+					return registerIntervalSlot(ptrMemFunc, *p);
+				return Connection();
 			}
 
 		private:
+			friend class FDEvtSource;
+
+			/** Bookkeeping for an added FDEvtSource. Lives in the registry; its address is stable until it is erased. */
+			struct Registration {
+				boost::shared_ptr<FDEvtSource> source;
+				size_t pollIndex; ///< Index into fds and pollRegistrations (POLL engine only)
+				bool attached; ///< True once being watched by the engine
+				bool removing; ///< True if queued for removal; the source will not be dispatched again
+			};
+			typedef boost::unordered_map<FDEvtSource*, Registration> Registry;
+
+			bool attach(Registration& r);
+			void detach(Registration& r);
+			void erase(Registry::iterator i);
+			void dispatch(Registration& r, bool readable, bool writable);
+			void setWriteInterest(FDEvtSource* source, bool writable);
+			void waitPoll(const timespec& wait);
+			void waitEpoll(const timespec& wait);
+
+			void insertWakeup(FDEvtSource* source);
+			void removeWakeup(FDEvtSource* source);
+			void siftWakeupUp(size_t i);
+			void siftWakeupDown(size_t i);
+			void fireWakeups();
+			void runPosted();
+			void iterate();
+
 			const int timeout; //in milliseconds
-			size_t indexFDSource(FDEvtSource* fdsource);
+			Engine engine;
+			int epollfd; ///< epoll instance (EPOLL engine only)
 
 			timespec timeLastInterval; ///< Time last interval handler was executed
 			int adjustedTimeout; ///< Adjusted so that (current time) + adjustedTimeout - timeLastInterval = timeout
-			std::vector<boost::shared_ptr<FDEvtSource> > fdsources;
-			std::vector<pollfd> fds;
-			std::vector<size_t> deleteQueue;
-			std::queue<boost::shared_ptr<FDEvtSource> > addQueue;
-			boost::signal<void ()> intervalSignal;
+			Registry registry;
+			std::vector<pollfd> fds; ///< POLL engine only
+			std::vector<Registration*> pollRegistrations; ///< Parallel to fds (POLL engine only)
+			std::vector<FDEvtSource*> wakeups; ///< Min-heap of sources with pending wakeups, earliest first
+			std::vector<FDEvtSource*> dueWakeups; ///< Scratch list of wakeups being fired
+			std::vector<FDEvtSource*> deleteQueue;
+			std::queue<FDEvtSource*> addQueue;
+			Signal<void ()> intervalSignal;
+			bool stateBatching; ///< Wrap each iteration in a State batch
 			bool running;
+			bool stopping; ///< True if stop() was called during the current run()
+			bool runUntilStopped; ///< Keep running without sources
+			int postfd; ///< eventfd signalled when tasks are posted; -1 if unavailable
+			int postSignalled; ///< 1 from the first post() until the loop drains postfd
+			bool postReadable; ///< True if the last wait found postfd readable
+			MpscQueue<Task> posted; ///< Tasks posted from any thread
 	};
 }
 
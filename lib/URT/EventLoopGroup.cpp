@@ -0,0 +1,214 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EventLoopGroup.h"
+#include "State.h"
+#include <boost/bind.hpp>
+
+using namespace urt;
+
+static __thread const EventLoopGroup* currentGroup = 0; ///< Group whose loop the calling thread runs, if any
+static __thread size_t currentIndex = 0; ///< Index of that loop
+
+namespace {
+/** Lets one thread wait for a task run on another to produce a value. */
+class Rendezvous {
+public:
+	Rendezvous() : done(false) {
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+	~Rendezvous() {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+	/** Store the value and wake the waiting thread. */
+	void complete(const std::string& v) {
+		pthread_mutex_lock(&mutex);
+		value = v;
+		done = true;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	/** @return value, once complete() has been called */
+	std::string wait() {
+		pthread_mutex_lock(&mutex);
+		while(!done)
+			pthread_cond_wait(&cond, &mutex);
+		pthread_mutex_unlock(&mutex);
+		return value;
+	}
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool done;
+	std::string value;
+};
+
+void addSource(EventLoop* loop, const boost::shared_ptr<FDEvtSource>& fdsource) {
+	loop->add(fdsource);
+}
+void setSubstate(const std::string& key, const std::string& value) {
+	State::set(key, value);
+}
+void getSubstate(const std::string& key, Rendezvous* r) {
+	r->complete(State::get(key));
+}
+}
+
+/**
+ * Create a group of loops. No threads are started until start().
+ * @param count number of loops; at least 1
+ * @param timeout interval of each loop, as in EventLoop::EventLoop()
+ * @param engine engine of each loop, as in EventLoop::EventLoop()
+ */
+EventLoopGroup::EventLoopGroup(size_t count, int timeout, EventLoop::Engine engine) : started(false) {
+	for(size_t i = 0; i < (count ? count : 1); i++) {
+		loops.push_back(new Member(*this, i, timeout, engine));
+		loops.back()->loop.setRunUntilStopped(true);
+	}
+}
+
+/**
+ * Stops and joins every loop, then destroys them along with their sources.
+ */
+EventLoopGroup::~EventLoopGroup() {
+	stop();
+	join();
+	for(size_t i = 0; i < stateConnections.size(); i++)
+		stateConnections[i].disconnect();
+	for(size_t i = 0; i < loops.size(); i++)
+		delete loops[i];
+}
+
+bool EventLoopGroup::inLoop(size_t i) const {
+	return currentGroup == this && currentIndex == i;
+}
+
+/**
+ * Add an FDEvtSource to a loop without transferring ownership, as in EventLoop::add(const boost::shared_ptr<FDEvtSource>&).
+ * May be called from any thread.
+ * @param fdsource shared pointer to the FDEvtSource to add
+ * @param i index of loop
+ * @return false if the source could not be added; always true if the addition was posted to another loop
+ */
+bool EventLoopGroup::add(const boost::shared_ptr<FDEvtSource>& fdsource, size_t i) {
+	if(!started || inLoop(i))
+		return loops[i]->loop.add(fdsource);
+	post(i, boost::bind(&addSource, &loops[i]->loop, fdsource));
+	return true;
+}
+
+void* EventLoopGroup::threadMain(void* member) {
+	Member* m = static_cast<Member*>(member);
+	currentGroup = &m->group;
+	currentIndex = m->index;
+	m->loop.run();
+	return NULL;
+}
+
+/**
+ * Start a thread for each loop.
+ * @throws ThreadException thrown if a thread cannot be created; loops already started are stopped and joined
+ */
+void EventLoopGroup::start() throw (ThreadException) {
+	if(started)
+		return;
+	started = true;
+	for(size_t i = 0; i < loops.size(); i++) {
+		if(pthread_create(&loops[i]->thread, NULL, &EventLoopGroup::threadMain, loops[i]) != 0) {
+			stop();
+			join();
+			throw ThreadException("Unable to create EventLoopGroup thread");
+		}
+		loops[i]->started = true;
+	}
+}
+
+/**
+ * Ask every loop to stop once its current iteration is complete. May be called from any thread; returns immediately.
+ */
+void EventLoopGroup::stop() {
+	for(size_t i = 0; i < loops.size(); i++)
+		post(i, boost::bind(&EventLoop::stop, &loops[i]->loop));
+}
+
+/**
+ * Wait for every loop's thread to finish. Must not be called from a loop of this group.
+ */
+void EventLoopGroup::join() {
+	for(size_t i = 0; i < loops.size(); i++) {
+		if(loops[i]->started) {
+			pthread_join(loops[i]->thread, NULL);
+			loops[i]->started = false;
+		}
+	}
+	started = false;
+}
+
+/**
+ * Set a substate from any thread. Called from STATE_LOOP, or before start(), the substate is set immediately;
+ * otherwise, it is set when STATE_LOOP next runs its posted tasks.
+ * @param key substate's key
+ * @param value substate's value
+ */
+void EventLoopGroup::setState(const std::string& key, const std::string& value) {
+	if(!started || inLoop(STATE_LOOP))
+		State::set(key, value);
+	else
+		post(STATE_LOOP, boost::bind(&setSubstate, key, value));
+}
+
+/**
+ * Get a substate from any thread. Unless called from STATE_LOOP or before start(), this waits for STATE_LOOP to
+ * fetch the value, so it should not be used where latency matters; registerStateSlot() delivers changes instead.
+ * @param key substate's key
+ * @return substate's value
+ */
+std::string EventLoopGroup::getState(const std::string& key) {
+	if(!started || inLoop(STATE_LOOP))
+		return State::get(key);
+	Rendezvous r;
+	post(STATE_LOOP, boost::bind(&getSubstate, key, &r));
+	return r.wait();
+}
+
+/**
+ * Call a slot on a given loop whenever a substate changes. The slot receives the key and value as they were when the
+ * change occurred. The slot remains registered for the life of the group. May be called from any thread.
+ * @param key substate's key
+ * @param slot slot to call
+ * @param i index of loop on which to call \c slot
+ */
+void EventLoopGroup::registerStateSlot(const std::string& key, const StateSlot& slot, size_t i) {
+	if(!started || inLoop(STATE_LOOP))
+		connectStateSlot(key, slot, i);
+	else
+		post(STATE_LOOP, boost::bind(&EventLoopGroup::connectStateSlot, this, key, slot, i));
+}
+
+void EventLoopGroup::connectStateSlot(const std::string& key, const StateSlot& slot, size_t i) {
+	stateConnections.push_back(State::registerSlot(key, boost::bind(&EventLoopGroup::forwardState, this, _1, _2, slot, i)));
+}
+
+void EventLoopGroup::forwardState(const std::string& key, const std::string& value, const StateSlot& slot, size_t i) {
+	if(inLoop(i))
+		slot(key, value);
+	else
+		post(i, boost::bind(slot, key, value));
+}
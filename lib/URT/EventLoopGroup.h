@@ -0,0 +1,143 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENTLOOPGROUP_H_
+#define EVENTLOOPGROUP_H_
+
+#include "EventLoop.h"
+#include "FDEvtSource.h"
+#include "Signal.h"
+#include "urtexcept.h"
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace urt {
+
+/**
+ * Runs several EventLoops, each on its own thread, so that slow handlers on one loop (image processing, for example)
+ * do not delay the sources on another (serial devices, for example). Each source is pinned to one loop for its
+ * entire life and is only ever touched by that loop's thread; code on one loop reaches another by posting a task to
+ * it with post() (see EventLoop::post()), which never blocks or takes a lock.
+ *
+ * URT itself remains single-threaded: State, signals, and every source may only be used from one thread at a time.
+ * The group makes this workable by giving State to one loop, STATE_LOOP. Sources that use State directly, like
+ * StateDevice and StateSocket, must be added to that loop. Code on any other loop (or any other thread) uses the
+ * State facade instead: setState(), getState(), and registerStateSlot() forward to STATE_LOOP.
+ *
+ * A typical arrangement:
+ * @code
+ * urt::EventLoopGroup group(2);
+ * group.add(new urt::StateDevice("/dev/ttyUSB0"), urt::EventLoopGroup::STATE_LOOP);
+ * group.add(new Camera(), 1); //its handler calls group.setState("target", ...)
+ * group.start();
+ * group.join();
+ * @endcode
+ *
+ * Before start(), the loops may be configured and sources added freely from the constructing thread. Once started,
+ * each loop runs until stop() is called; loops with no sources of their own simply wait for posted tasks.
+ */
+class EventLoopGroup : boost::noncopyable {
+public:
+	/** Work posted to a loop. */
+	typedef EventLoop::Task Task;
+	/** Slot forwarded State changes are delivered to; see registerStateSlot(). */
+	typedef boost::function<void (const std::string&, const std::string&)> StateSlot;
+
+	static const size_t STATE_LOOP = 0; ///< Loop on which State and its signals are used
+
+	EventLoopGroup(size_t count, int timeout = 10000, EventLoop::Engine engine = EventLoop::URT_DEFAULT_ENGINE);
+	~EventLoopGroup();
+
+	/** @return number of loops */
+	size_t size() const { return loops.size(); }
+	/**
+	 * Get a loop, e.g., to register interval slots before start().
+	 * @param i index of loop
+	 * @return loop
+	 */
+	EventLoop& getLoop(size_t i) { return loops[i]->loop; }
+	/**
+	 * Determine whether the calling thread is running a loop of this group.
+	 * @param i index of loop
+	 * @return true if called from loop \c i
+	 */
+	bool inLoop(size_t i) const;
+
+	bool add(const boost::shared_ptr<FDEvtSource>& fdsource, size_t i);
+	/**
+	 * Add an FDEvtSource to a loop, which takes ownership of it as in EventLoop::add(T*). May be called from any thread.
+	 * If called from another thread once the group has started, the source is added when loop \c i next runs its
+	 * posted tasks.
+	 * @tparam T type of FDEvtSource to add
+	 * @param fdsource pointer to FDEvtSource to add
+	 * @param i index of loop
+	 * @return weak pointer to \c fdsource
+	 */
+	template<class T>
+	EvtSourcePtr<T> add(T* fdsource, size_t i)
+	{
+		boost::shared_ptr<T> ptr(fdsource);
+		if(add(boost::shared_ptr<FDEvtSource>(ptr), i))
+			return EvtSourcePtr<T>(ptr);
+		else
+			return EvtSourcePtr<T>();
+	}
+	/**
+	 * Run a task on a loop. May be called from any thread, including the loop's own, and never blocks.
+	 * @param i index of loop
+	 * @param task task to run
+	 * @see EventLoop::post()
+	 */
+	void post(size_t i, const Task& task) { loops[i]->loop.post(task); }
+
+	void start() throw (ThreadException);
+	void stop();
+	void join();
+
+	void setState(const std::string& key, const std::string& value);
+	std::string getState(const std::string& key);
+	void registerStateSlot(const std::string& key, const StateSlot& slot, size_t i);
+
+private:
+	/** One loop and its thread. */
+	struct Member {
+		Member(EventLoopGroup& group, size_t index, int timeout, EventLoop::Engine engine) :
+			group(group), index(index), loop(timeout, engine), started(false) {}
+		EventLoopGroup& group;
+		const size_t index;
+		EventLoop loop;
+		pthread_t thread;
+		bool started; ///< True if thread was created and has not been joined
+	};
+
+	static void* threadMain(void* member);
+	void connectStateSlot(const std::string& key, const StateSlot& slot, size_t i);
+	void forwardState(const std::string& key, const std::string& value, const StateSlot& slot, size_t i);
+
+	std::vector<Member*> loops;
+	bool started; ///< True from start() until join()
+	std::vector<Connection> stateConnections; ///< Made by registerStateSlot(); only touched on STATE_LOOP
+};
+
+}
+
+#endif /* EVENTLOOPGROUP_H_ */
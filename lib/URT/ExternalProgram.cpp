@@ -24,6 +24,8 @@
  */
 
 #include "ExternalProgram.h"
+#include "WorkerPool.h"
+#include <boost/bind.hpp>
 
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -53,15 +55,23 @@ internal::_ExternalProgram::_ExternalProgram(const char *const argv[], bool conn
 	_ExternalProgram::childPid = childPid; //save child pid
 }
 
+/**
+ * Kill a child process that ignored the TERM signal and reap it. Runs on the default WorkerPool.
+ * @param pid child process
+ * @param delay microseconds to wait for it to exit before killing it
+ */
+static void reap(int pid, int delay) {
+	usleep(delay);
+	if(waitpid(pid, NULL, WNOHANG) <= 0) { //still running
+		kill(pid, SIGKILL); //send kill signal
+		waitpid(pid, NULL, 0);
+	}
+}
+
 internal::_ExternalProgram::~_ExternalProgram() {
 	if(waitpid(childPid, NULL, WNOHANG) <= 0) { //still running
 		kill(childPid, SIGTERM); //send child process the term signal
-		usleep(SIGDELAY); //wait 1/10th second
-		if(waitpid(childPid, NULL, WNOHANG) <= 0) { //still running
-			kill(childPid, SIGKILL); //send kill signal
-			usleep(SIGDELAY);
-			waitpid(childPid, NULL, WNOHANG); //try to reap child process one last time
-		}
+		WorkerPool::getDefault().submit(boost::bind(&reap, childPid, static_cast<int>(SIGDELAY)));
 	}
 	close(sockets[0]);
 }
@@ -48,8 +48,8 @@ namespace internal {
 /**
  * This class permits the use and control of external child processes.
  *
- * Unfortunately, URT is not thread-safe at all. The use of the monostate/static State class, static
- * buffers in the StateSocket and ArdPort classes, and signals prohibits the use of threads with all
+ * Unfortunately, URT is not thread-safe at all. The use of the monostate/static State class
+ * and signals prohibits the use of threads with all
  * URT classes. However, the URT library does provide a more robust and useful alternative: ExternalProgram.
  *
  * The ExternalProgram class executes an external program as a child process, connecting its stdin, stdout, and
@@ -126,9 +126,9 @@ public:
 
 	/**
 	 * Terminate an external process.
-	 * If the process has not already terminated, a TERM signal will be sent followed by a delay of internal::_ExternalProgram::SIGDELAY microseconds.
-	 * If it has not terminated by then, a KILL signal will be sent followed again by an identical delay.
-	 * If it has not terminated by then, it will be dealt with later when the main process terminates and it becomes an orphan process.
+	 * If the process has not already terminated, a TERM signal will be sent. The rest happens on the default WorkerPool, so
+	 * destruction never blocks: after a delay of internal::_ExternalProgram::SIGDELAY microseconds, if the process has not
+	 * terminated, a KILL signal is sent, and the process is reaped once it exits.
 	 */
 	~ExternalProgram() {}
 };
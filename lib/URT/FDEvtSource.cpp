@@ -18,6 +18,8 @@
 
 #include "FDEvtSource.h"
 #include "EventLoop.h"
+#include <errno.h>
+#include <unistd.h>
 
 using namespace urt;
 
@@ -25,16 +27,156 @@ using namespace urt;
  * Creates an event handler with the protected variable fdesc set later.
  * @warning Calling any other function before setting fdesc will result in undefined behavior.
  */
-FDEvtSource::FDEvtSource() : fdesc(-1) {}
+FDEvtSource::FDEvtSource() : fdesc(-1), edgeTriggered(false), queuedWrites(false), evtloop(NULL), wakeupRequested(false),
+	wakeupIndex(WAKEUP_IDLE), writeOffset(0), highWaterMark(0), aboveHighWater(false) {}
 
 /**
  * Creates an event handler for a file descriptor.
  * @param fd file descriptor to watch
  */
-FDEvtSource::FDEvtSource(int fd) : fdesc(fd) {}
+FDEvtSource::FDEvtSource(int fd) : fdesc(fd), edgeTriggered(false), queuedWrites(false), evtloop(NULL), wakeupRequested(false),
+	wakeupIndex(WAKEUP_IDLE), writeOffset(0), highWaterMark(0), aboveHighWater(false) {}
 
 FDEvtSource::~FDEvtSource() {}
 
+/**
+ * Called by the EventLoop when a wakeup requested with scheduleWakeup() is due. A wakeup only occurs once; call
+ * scheduleWakeup() again (from this function, if desired) to be woken again. Does nothing by default.
+ * @return return false only to indicate that the event loop should deregister the source; otherwise, return true
+ */
+bool FDEvtSource::onWakeup() {
+	return true;
+}
+
+/**
+ * Requests that onWakeup() be called once the given time arrives, replacing any previously requested wakeup.
+ * If the source has not been added to an EventLoop yet, the request is remembered and takes effect once it is added;
+ * should the time already have passed by then, the wakeup occurs immediately.
+ * @param when time at which to wake, as measured by CLOCK_MONOTONIC
+ */
+void FDEvtSource::scheduleWakeup(const timespec& when) {
+	wakeupTime = when;
+	wakeupRequested = true;
+	if(evtloop)
+		evtloop->insertWakeup(this);
+}
+
+/**
+ * Cancels any outstanding wakeup. Does nothing if none was requested.
+ */
+void FDEvtSource::cancelWakeup() {
+	wakeupRequested = false;
+	if(evtloop)
+		evtloop->removeWakeup(this);
+}
+
+/**
+ * Write data without blocking, queuing whatever the file does not accept immediately. Queued data is written, in order,
+ * as the file becomes writable while the source is in an EventLoop. Data is never reordered: if anything is already
+ * queued, the new data is appended without attempting a write.
+ * @param buf data to write
+ * @param size number of bytes to write
+ * @return false if the write failed for any reason other than the file being full
+ */
+bool FDEvtSource::queueWrite(const void* buf, size_t size) {
+	iovec iov = {const_cast<void*>(buf), size};
+	return queueWrite(&iov, 1);
+}
+
+/**
+ * Write data gathered from several buffers without blocking, queuing whatever the file does not accept immediately.
+ * @overload
+ * @param iov buffers to write, in order
+ * @param count number of buffers
+ */
+bool FDEvtSource::queueWrite(const iovec* iov, int count) {
+	const bool wasEmpty = (getQueuedBytes() == 0);
+	size_t written = 0;
+	if(wasEmpty) {
+		const ssize_t r = writeSome(iov, count);
+		if(r >= 0)
+			written = r;
+		else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return false;
+	}
+
+	for(int i = 0; i < count; i++) {
+		const char* base = static_cast<const char*>(iov[i].iov_base);
+		if(written >= iov[i].iov_len) {
+			written -= iov[i].iov_len;
+			continue;
+		}
+		writeQueue.insert(writeQueue.end(), base + written, base + iov[i].iov_len);
+		written = 0;
+	}
+
+	const size_t queued = getQueuedBytes();
+	if(wasEmpty && queued && evtloop)
+		evtloop->setWriteInterest(this, true);
+	if(highWaterMark && !aboveHighWater && queued > highWaterMark) {
+		aboveHighWater = true;
+		onHighWater();
+	}
+	return true;
+}
+
+/**
+ * Write as much of the given data as the file accepts without blocking. Used for all queued writes.
+ * The default implementation calls writev(), so the file descriptor should be non-blocking; override to use
+ * some other means (such as a non-blocking flag to send()).
+ * @param iov buffers to write, in order
+ * @param count number of buffers
+ * @return number of bytes written, or -1 with errno set on error
+ */
+ssize_t FDEvtSource::writeSome(const iovec* iov, int count) {
+	return writev(fdesc, iov, count);
+}
+
+/**
+ * Called when the outbound queue grows beyond the high-water mark (see setHighWaterMark()). It is not called again until
+ * the queue has drained. Does nothing by default.
+ */
+void FDEvtSource::onHighWater() {}
+
+/**
+ * Called by the EventLoop once the outbound queue has been completely written. Does nothing by default.
+ */
+void FDEvtSource::onDrained() {}
+
+/**
+ * Called by the EventLoop when the file is writable: write as much queued data as possible.
+ * @return false if the write failed
+ */
+bool FDEvtSource::flushWrites() {
+	while(getQueuedBytes()) {
+		iovec iov = {&writeQueue[writeOffset], getQueuedBytes()};
+		const ssize_t r = writeSome(&iov, 1);
+		if(r < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			return false;
+		}
+		if(r == 0)
+			break;
+		writeOffset += r;
+	}
+
+	if(writeOffset == writeQueue.size()) {
+		writeQueue.clear();
+		writeOffset = 0;
+	} else if(writeOffset > writeQueue.size() / 2) {
+		writeQueue.erase(writeQueue.begin(), writeQueue.begin() + writeOffset);
+		writeOffset = 0;
+	}
+
+	if(writeQueue.empty()) {
+		if(evtloop)
+			evtloop->setWriteInterest(this, false);
+		aboveHighWater = false;
+		onDrained();
+	}
+	return true;
+}
 
 /**@fn FDEvtSource::onActivity
  * Pure virtual function called when something happens to the file descriptor (either there is data to be read,
@@ -45,3 +187,13 @@ FDEvtSource::~FDEvtSource() {}
  * File descriptor to watch. Can either be set by subclass or at instantiation.
  * @attention Must be set prior to using any function. Do not change while attached to event loop.
  */
+/**@var FDEvtSource::edgeTriggered
+ * If true, an EventLoop using the EPOLL engine will only generate an event when new activity arrives rather than whenever
+ * data remains unread. onActivity() must then consume everything available (i.e., read until the call would block) or
+ * the remaining data will go unnoticed. Ignored by the POLL engine. Defaults to false.
+ * @attention Must be set prior to adding the source to an EventLoop.
+ */
+/**@var FDEvtSource::queuedWrites
+ * If true, the send functions of subclasses that support it (such as Socket and SerialPort) use queueWrite() rather than
+ * writing synchronously. Defaults to false.
+ */
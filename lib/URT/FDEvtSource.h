@@ -19,7 +19,11 @@
 #ifndef FDEVTSOURCE_H_
 #define FDEVTSOURCE_H_
 #include <boost/utility.hpp>
-#include <boost/signals/trackable.hpp>
+#include "Signal.h"
+#include <ctime>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 namespace urt
 {
@@ -38,23 +42,60 @@ namespace urt
 	 *  </li>
 	 *  </ol>
 	 *
-	 *  @note No events are generated while writing to a file descriptor; all writing I/O is synchronous.
+	 *  A source may also ask its EventLoop to wake it at a given time with scheduleWakeup(), in which case onWakeup() is called
+	 *  once that time arrives. Wakeups are kept by the EventLoop itself and cost neither threads nor file descriptors. A source
+	 *  that only needs wakeups (such as Timer) may leave \c fdesc negative; it will not be watched for I/O.
+	 *
+	 *  Writing is synchronous unless a source queues its output with queueWrite(). Whatever cannot be written immediately is
+	 *  kept in an outbound queue, and the EventLoop watches the descriptor for writability only while the queue is non-empty,
+	 *  resuming partial writes as the file accepts more. A source may set a high-water mark to be told, through onHighWater(),
+	 *  that its peer is not keeping up; onDrained() is called once the queue has been emptied.
 	 */
-	class FDEvtSource : public boost::signals::trackable, boost::noncopyable
+	class FDEvtSource : public Trackable, boost::noncopyable
 	{
 		public:
 			FDEvtSource();
 			FDEvtSource(int fd);
 			virtual ~FDEvtSource();
 
+			/** @return number of bytes waiting in the outbound queue */
+			size_t getQueuedBytes() const { return writeQueue.size() - writeOffset; }
+
 		protected:
 			virtual bool onActivity() = 0;
+			virtual bool onWakeup();
+			void scheduleWakeup(const timespec& when);
+			void cancelWakeup();
+			bool queueWrite(const void* buf, size_t size);
+			bool queueWrite(const iovec* iov, int count);
+			virtual ssize_t writeSome(const iovec* iov, int count);
+			virtual void onHighWater();
+			virtual void onDrained();
+			/** Sets the queue size beyond which onHighWater() is called. 0 (the default) disables it.
+			 *  @param bytes high-water mark in bytes */
+			void setHighWaterMark(size_t bytes) { highWaterMark = bytes; }
 			int fdesc;
+			bool edgeTriggered;
+			bool queuedWrites;
 
 		private:
 			//FDEvtSource(const FDEvtSource&); //not copyable
 			//FDEvtSource& operator=(const FDEvtSource&); //not copyable
 			friend class EventLoop;
+
+			static const size_t WAKEUP_IDLE = static_cast<size_t>(-1); ///< wakeupIndex when not in a wakeup heap
+			static const size_t WAKEUP_DUE = static_cast<size_t>(-2); ///< wakeupIndex when about to be woken
+
+			bool flushWrites();
+
+			EventLoop* evtloop; ///< EventLoop watching this source, if any
+			timespec wakeupTime; ///< Requested wakeup time (CLOCK_MONOTONIC)
+			bool wakeupRequested; ///< True if a wakeup is outstanding, even if not yet in an EventLoop
+			size_t wakeupIndex; ///< Position in the EventLoop's wakeup heap
+			std::vector<char> writeQueue; ///< Outbound data not yet written lies in [writeOffset, end)
+			size_t writeOffset; ///< Start of unwritten data in writeQueue
+			size_t highWaterMark; ///< Queue size that triggers onHighWater(); 0 if disabled
+			bool aboveHighWater; ///< True once onHighWater() was called, until the queue drains
 	};
 }
 
@@ -0,0 +1,170 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FUTURE_H_
+#define FUTURE_H_
+
+#include "urtexcept.h"
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace urt {
+
+template<class T> class Promise;
+
+/** Members of Future common to every result type. */
+class FutureBase {
+public:
+	/** State of a request. */
+	enum Status {
+		PENDING,	///< No reply yet
+		READY,		///< Reply received; get() returns it
+		TIMED_OUT,	///< No reply within the timeout
+		CANCELLED	///< The device was closed, or the Future belongs to no request
+	};
+};
+
+/**
+ * The eventual result of a request to a device, such as StateDevice::request() or contrib::Ax3500::queryBatteryVoltage().
+ * Requests never block: the request is sent, and the Future returned at once. The device's source resolves it when the
+ * matching reply arrives, or fails it once its timeout passes, from within the EventLoop, so several requests may be
+ * outstanding on one device at a time.
+ *
+ * Rather than waiting, attach a continuation with then(); it is called on the EventLoop's thread as soon as the request
+ * completes, or immediately if it already has:
+ * @code
+ * device->request("heading").then(boost::bind(&Pilot::onHeading, this, _1));
+ * ...
+ * void Pilot::onHeading(const urt::Future<std::string>& f) {
+ * 	if(f.isReady())
+ * 		steer(f.get());
+ * }
+ * @endcode
+ *
+ * Futures are cheap to copy; every copy refers to the same result. Like the rest of URT, they may only be used from the
+ * thread running the EventLoop of the device that made them.
+ * @tparam T type of result
+ */
+template<class T>
+class Future : public FutureBase {
+public:
+	/** Called once the request completes, with its Future. */
+	typedef boost::function<void (const Future<T>&)> Continuation;
+
+	/** Creates a Future that belongs to no request; its status is CANCELLED. */
+	Future() {}
+
+	/** @return state of the request */
+	Status getStatus() const { return shared ? shared->status : CANCELLED; }
+	/** @return true until the request completes */
+	bool isPending() const { return getStatus() == PENDING; }
+	/** @return true if the reply has been received */
+	bool isReady() const { return getStatus() == READY; }
+	/**
+	 * Get the result of the request.
+	 * @return the result
+	 * @throws RequestException thrown unless isReady()
+	 */
+	const T& get() const throw (RequestException) {
+		switch(getStatus()) {
+			case READY: return shared->value;
+			case PENDING: throw RequestException("request still pending");
+			case TIMED_OUT: throw RequestException("request timed out");
+			default: throw RequestException("request cancelled");
+		}
+	}
+	/**
+	 * Call a function once the request completes, whether or not it succeeds. Continuations are called in the order
+	 * they were attached and should not throw.
+	 * @param c continuation; called immediately if the request has already completed
+	 */
+	void then(const Continuation& c) const {
+		if(isPending())
+			shared->continuations.push_back(c);
+		else
+			c(*this);
+	}
+
+private:
+	friend class Promise<T>;
+
+	/** Result shared by a Promise and its Futures. */
+	struct Shared {
+		Shared() : status(PENDING) {}
+		Status status;
+		T value;
+		std::vector<Continuation> continuations; ///< Waiting for the request to complete
+	};
+
+	explicit Future(const boost::shared_ptr<Shared>& shared) : shared(shared) {}
+
+	boost::shared_ptr<Shared> shared;
+};
+
+/**
+ * The device's side of a Future: created when a request is sent and completed by the device's source. Completing a
+ * Promise that has already completed does nothing, so a late reply is harmless.
+ * @tparam T type of result
+ */
+template<class T>
+class Promise {
+public:
+	typedef FutureBase::Status Status;
+
+	Promise() : shared(new typename Future<T>::Shared) {}
+
+	/** @return a Future for the result */
+	Future<T> getFuture() const { return Future<T>(shared); }
+	/** @return true until completed */
+	bool isPending() const { return shared->status == FutureBase::PENDING; }
+	/**
+	 * Complete the request with its result and call the continuations.
+	 * @param value result
+	 */
+	void resolve(const T& value) {
+		if(!isPending())
+			return;
+		shared->value = value;
+		complete(FutureBase::READY);
+	}
+	/**
+	 * Complete the request without a result and call the continuations.
+	 * @param status FutureBase::TIMED_OUT or FutureBase::CANCELLED
+	 */
+	void fail(Status status) {
+		if(isPending())
+			complete(status);
+	}
+
+private:
+	void complete(Status status) {
+		shared->status = status;
+		std::vector<typename Future<T>::Continuation> continuations;
+		continuations.swap(shared->continuations);
+		const Future<T> f(shared);
+		for(size_t i = 0; i < continuations.size(); i++)
+			continuations[i](f);
+	}
+
+	boost::shared_ptr<typename Future<T>::Shared> shared;
+};
+
+}
+
+#endif /* FUTURE_H_ */
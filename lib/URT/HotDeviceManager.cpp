@@ -24,10 +24,13 @@
 #include <cstring>
 #include <string>
 #include <stdexcept>
+#include <ctime>
 #include <unistd.h>
 
 namespace urt{
 
+static const long RETRY_DELAY = 500; ///< Milliseconds before trying a new device again, so its device file can stabilize
+
 HotDeviceManager::HotDeviceManager(EventLoop& loop) : m_loop(loop) {
 	fdesc = inotify_init1(IN_CLOEXEC);
 }
@@ -58,29 +61,9 @@ bool HotDeviceManager::onActivity() {
 		if(boost::regex_match(event->name, d->m_rule)) {
 			boost::filesystem::path absPath = d->m_directory; absPath /= std::string(event->name);
 			Log::msg<<"Detected newly added "<<absPath<<std::endl;
-			StateDevice* device = NULL;
-			try {
-				device = new StateDevice(absPath.string().c_str());
-			} catch(...) {
-				try {
-					usleep(500000); //sleep for .5 seconds so device file can stabilize and try again
-					device = new StateDevice(absPath.string().c_str());
-				} catch (std::exception& e) {
-					Log::err<<"Error loading "<<absPath<<". "<<e.what()<<std::endl;
-					delete device; //if construction failed, it will be null and okay to delete
-					
-					addFailed(absPath.string());
-				}
-			}
-			if(device != NULL) {
-				boost::shared_ptr<StateDevice> ptr(device);
-				if(onFound(ptr)) {
-					m_loop.registerIntervalSlot(&urt::StateDevice::poll, *ptr);
-					m_loop.add(ptr);
-				} else {
-					urt::Log::err<<"Error loading "<<absPath<<". Vetoed."<<std::endl;
-				}
-			}
+			std::string error;
+			if(!probe(absPath.string(), m_loop, error, true))
+				retryLater(absPath.string());
 		}
 			
 		r -= sizeof(inotify_event) + event->len;
@@ -89,4 +72,27 @@ bool HotDeviceManager::onActivity() {
 	return true;
 }
 
+void HotDeviceManager::retryLater(const std::string& path) {
+	m_retry.push_back(path);
+	timespec when;
+	clock_gettime(CLOCK_MONOTONIC, &when);
+	when.tv_nsec += RETRY_DELAY * 1000000L;
+	if(when.tv_nsec >= 1000000000L) {
+		when.tv_sec++;
+		when.tv_nsec -= 1000000000L;
+	}
+	scheduleWakeup(when);
+}
+
+bool HotDeviceManager::onWakeup() {
+	std::vector<std::string> retry;
+	retry.swap(m_retry);
+	for(std::vector<std::string>::iterator i = retry.begin(); i != retry.end(); i++) {
+		std::string error;
+		if(!probe(*i, m_loop, error))
+			fail(*i, error);
+	}
+	return true;
+}
+
 }
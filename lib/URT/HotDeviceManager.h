@@ -23,7 +23,7 @@
 #include "FDEvtSource.h"
 
 #include <boost/unordered_map.hpp>
-#include <boost/weak_ptr.hpp>
+#include <vector>
 
 #ifdef __linux__
 #include <linux/version.h>
@@ -46,6 +46,10 @@ namespace urt {
   * @note Unlike StateDeviceNotifier, the HotDeviceManager does not watch for the deletion of device
   * files. In theory, should a device no longer exist, the file descriptor will enter an error state
   * and generate an event; watching for the deletion of device files, therefore, is unnecessary.
+  *
+  * A new device handshakes asynchronously in the EventLoop like any other (see DeviceManager), so a
+  * hot-plugged device never stalls the rest of the loop. Since a device file may not be usable as soon
+  * as it appears, a device that cannot be opened or does not answer is tried once more half a second later.
   */
 class HotDeviceManager : public DeviceManager, public urt::FDEvtSource {
 public:
@@ -69,8 +73,11 @@ public:
 private:
 	EventLoop& m_loop;
 	boost::unordered_map<int, Directory*> m_directoryMap;
+	std::vector<std::string> m_retry; ///< Devices to try again at the next wakeup
 	
 	bool onActivity();
+	bool onWakeup();
+	void retryLater(const std::string& path);
 };
 
 }
@@ -0,0 +1,92 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPSCQUEUE_H_
+#define MPSCQUEUE_H_
+
+#include <boost/utility.hpp>
+#include <algorithm>
+
+namespace urt {
+
+/**
+ * Unbounded lock-free FIFO with any number of producers and a single consumer. Producers never block or spin: push()
+ * is one allocation and one atomic exchange. The consumer never blocks either; pop() returns false if the queue is
+ * empty or if a producer is midway through a push(), in which case the element becomes visible on a later pop().
+ *
+ * Values are moved out with swap(), so T must be default-constructible and swappable. Copying a queue is not
+ * permitted.
+ *
+ * @note Uses the GCC __atomic builtins (GCC 4.7 or later). Every atomic operation is sequentially consistent, so a
+ * 	consumer that observes some other shared flag after a producer set it, having pushed first, will find the element.
+ * @tparam T element type
+ */
+template<class T>
+class MpscQueue : boost::noncopyable {
+public:
+	MpscQueue() : head(new Node), tail(head) {}
+	/** Destroys any elements still queued. Must not run concurrently with push(). */
+	~MpscQueue() {
+		while(tail) {
+			Node* n = tail->next;
+			delete tail;
+			tail = n;
+		}
+	}
+
+	/**
+	 * Append an element. May be called from any thread.
+	 * @param value element to append
+	 */
+	void push(const T& value) {
+		Node* n = new Node(value);
+		Node* prev = __atomic_exchange_n(&head, n, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&prev->next, n, __ATOMIC_SEQ_CST); //publishes the node's contents
+	}
+	/**
+	 * Remove the oldest element. Must only be called from the consuming thread.
+	 * @param value set to the element removed, if any
+	 * @return false if no element was available
+	 */
+	bool pop(T& value) {
+		Node* next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+		if(!next)
+			return false;
+		std::swap(value, next->value);
+		delete tail;
+		tail = next; //next becomes the (now empty) placeholder
+		return true;
+	}
+	/** @return true if no element is available to the consumer; only meaningful on the consuming thread */
+	bool empty() const { return __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST) == 0; }
+
+private:
+	struct Node {
+		Node() : next(0) {}
+		explicit Node(const T& v) : next(0), value(v) {}
+		Node* next;
+		T value;
+	};
+
+	Node* head; ///< Most recently pushed node; shared by producers
+	Node* tail; ///< Placeholder before the oldest element; owned by the consumer
+};
+
+}
+
+#endif /* MPSCQUEUE_H_ */
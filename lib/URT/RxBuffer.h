@@ -0,0 +1,58 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RXBUFFER_H_
+#define RXBUFFER_H_
+
+#include <cstddef>
+#include <cstring> //for std::memmove
+#include <vector>
+
+namespace urt {
+namespace detail {
+
+static const size_t RX_MIN_SPACE = 256; ///< Room for a whole legacy ARD datagram or StateSocket message
+
+/**
+ * Make room to read more bytes into a receive buffer, as used by ArdPort and StateSocket. Received bytes not yet
+ * consumed lie in [start, end). If fewer than RX_MIN_SPACE bytes are free after them, they are moved to the front of
+ * the buffer; if that is still not enough, which only happens while an extended message is arriving, the buffer is
+ * doubled.
+ * @param buffer receive buffer; must not be empty
+ * @param start start of first unconsumed byte; updated
+ * @param end end of received bytes; updated
+ * @return number of bytes that may be read into the buffer at \c end
+ */
+template<typename T>
+inline size_t prepareRxBuffer(std::vector<T>& buffer, size_t& start, size_t& end) {
+	if(start == end) {
+		start = end = 0;
+	} else if(start > 0 && buffer.size() - end < RX_MIN_SPACE) {
+		std::memmove(&buffer[0], &buffer[start], (end - start) * sizeof(T));
+		end -= start;
+		start = 0;
+	}
+	if(buffer.size() - end < RX_MIN_SPACE)
+		buffer.resize(buffer.size() * 2);
+	return buffer.size() - end;
+}
+
+}
+}
+
+#endif /* RXBUFFER_H_ */
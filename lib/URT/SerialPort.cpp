@@ -40,7 +40,7 @@ using namespace urt;
  * @param twoBits use two stops bits as opposed to one
  */
 SerialPort::SerialPort(const char* dev, tcflag_t baud, bool echo, bool block, tcflag_t dataBits, Parity parity, bool twoBits) throw (SerialException)
-	: block(block), path(dev)
+	: block(block), drain(true), path(dev)
 {
 	/*
 	 * Note: The below differentiation between blocking and non-blocking doesn't appear to actually do anything.
@@ -132,6 +132,17 @@ void SerialPort::setTimeout(unsigned int deciseconds) {
 	tcsetattr(fdesc, TCSANOW, &options);
 }
 
+/**
+  * Sets the minimum number of bytes a blocking read waits for.
+  * @param numBytes minimum number of bytes (VMIN)
+  * @note get() adjusts this as needed; only the attributes are changed, so it is cheap to call get() repeatedly
+  *      with the same size.
+  */
+void SerialPort::setReadMinimum(unsigned char numBytes) {
+	options.c_cc[VMIN] = numBytes;
+	tcsetattr(fdesc, TCSANOW, &options);
+}
+
 //limited to unsigned char due to maximum VMIN can be set (see .cpp file)
 /**
  * Read data from serial buffer.
@@ -144,10 +155,8 @@ void SerialPort::setTimeout(unsigned int deciseconds) {
 int SerialPort::get(char* buf, unsigned char numBytes) throw (SerialException)
 {
 	if(!numBytes) return 0;
-	if(block) {
-		options.c_cc[VMIN] = numBytes; //set the minimum number of bytes with which to return
-		tcsetattr(fdesc, TCSANOW, &options);
-	}
+	if(block && options.c_cc[VMIN] != numBytes)
+		setReadMinimum(numBytes);
 	const int r = read(fdesc, buf, numBytes);
 	if(r == 0) //EOF
 		throw SerialException("EOF received on port (port closed)");
@@ -156,18 +165,87 @@ int SerialPort::get(char* buf, unsigned char numBytes) throw (SerialException)
 	return r;
 }
 
+/**
+ * Read whatever data is waiting in the serial buffer without changing the port attributes.
+ * Intended to be called from onActivity(), when the port is known to be readable; with the
+ * read minimum set to 1 (see setReadMinimum()), the call returns immediately with every byte
+ * available, up to \a maxBytes.
+ * @throw SerialException if the port was closed or unable to read
+ * @param buf buffer in which to read data
+ * @param maxBytes size of \a buf
+ * @return number of bytes read; 0 only if \a maxBytes is 0 or the read would block
+ */
+size_t SerialPort::getAvailable(char* buf, size_t maxBytes) throw (SerialException)
+{
+	if(!maxBytes) return 0;
+	const ssize_t r = read(fdesc, buf, maxBytes);
+	if(r == 0) //EOF
+		throw SerialException("EOF received on port (port closed)");
+	if(r == -1) {
+		if(errno == EAGAIN || errno == EINTR)
+			return 0;
+		throw SerialException("cannot read from port");
+	}
+	return r;
+}
+
 void nothing_handler(int signal) {}
 /**
- * Send data across serial port.
+ * Send data across serial port. If queued writes are enabled (see setQueuedWrites()), the data is queued instead.
  * @throw SerialException if unable to send all data
  * @param buf buffer from which to read data
  * @param numBytes number of bytes to send
  */
 void SerialPort::send(const char* buf, size_t numBytes) throw (SerialException)
 {
+	if(queuedWrites) {
+		if(!queueWrite(buf, numBytes))
+			throw SerialException("cannot send to port");
+		return;
+	}
 	if(write(fdesc, buf, numBytes) == -1)
 		throw SerialException("cannot send to port");
-	
+	if(drain)
+		drainOutput();
+}
+
+/**
+ * Send data gathered from several buffers across serial port with a single system call.
+ * @throw SerialException if unable to send all data
+ * @param iov buffers from which to read data, in order
+ * @param count number of buffers
+ */
+void SerialPort::send(const iovec* iov, int count) throw (SerialException)
+{
+	if(queuedWrites) {
+		if(!queueWrite(iov, count))
+			throw SerialException("cannot send to port");
+		return;
+	}
+	if(writev(fdesc, iov, count) == -1)
+		throw SerialException("cannot send to port");
+	if(drain)
+		drainOutput();
+}
+
+/**
+ * Sets whether send() queues its data (see FDEvtSource::queueWrite) rather than writing synchronously.
+ * Enabling queued writes puts the port in non-blocking mode; get() then returns only what is available
+ * and never waits.
+ * @param enable true to queue writes
+ */
+void SerialPort::setQueuedWrites(bool enable) {
+	queuedWrites = enable;
+	int flags = fcntl(fdesc, F_GETFL);
+	fcntl(fdesc, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+/**
+ * Wait until all output has been transmitted, giving up after a second.
+ * @throw SerialException on error
+ */
+void SerialPort::drainOutput() throw (SerialException)
+{
 	//The SIGALRM signal will interrupt tcdrain and prevent it from hanging the program. First save the
 	//previous handler and alarm state (if any) so as to minimally disrupt the use of SIGALRM elsewhere.
 	struct sigaction old, act;
@@ -184,4 +262,3 @@ void SerialPort::send(const char* buf, size_t numBytes) throw (SerialException)
 	if(bad)
 		throw SerialException("error on serial port");
 }
-
@@ -20,6 +20,7 @@
 #define SERIALPORT_H_
 
 #include <termios.h>
+#include <sys/uio.h>
 #include <stdexcept>
 #include "urtexcept.h"
 #include "FDEvtSource.h"
@@ -53,16 +54,27 @@ namespace urt
 			virtual ~SerialPort();
 
 			int get(char* buf, unsigned char numBytes) throw (SerialException);
+			size_t getAvailable(char* buf, size_t maxBytes) throw (SerialException);
 			void send(const char* buf, size_t numBytes) throw (SerialException);
+			void send(const iovec* iov, int count) throw (SerialException);
 			void flushInput();
 			void setSpeed(const tcflag_t& baud);
 			void setTimeout(unsigned int deciseconds = 0);
+			/** Sets whether send() waits for the data to be transmitted before returning. Enabled by default.
+			 *  @param drain true to wait (tcdrain) after every send
+			 */
+			void setDrain(bool drain) { this->drain = drain; }
+			void setQueuedWrites(bool enable);
+			void setReadMinimum(unsigned char numBytes);
 			/** Gets path associated with device.
 			 *  @return path associated with device
 			 */
 			const std::string& getPath() { return path; }
 		private:
+			void drainOutput() throw (SerialException);
+
 			bool block;
+			bool drain; ///< Wait for transmission after each send
 			termios options;
 			std::string path;
 	};
@@ -0,0 +1,94 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Signal.h"
+
+using namespace urt;
+using namespace urt::detail;
+
+Trackable::~Trackable() {
+	while(tracked)
+		tracked->signal->disconnect(tracked);
+}
+
+/**
+ * Disconnect every slot.
+ */
+void SignalBase::disconnectAll() {
+	SlotNode* n = head;
+	while(n) {
+		SlotNode* next = n->next; //n may be freed by disconnect()
+		if(n->signal)
+			disconnect(n);
+		n = next;
+	}
+}
+
+/**
+ * Disconnect a slot. If the signal is being fired, the node stays in the list (marked disconnected, so it is skipped)
+ * until firing finishes.
+ * @param node connected slot of this signal
+ */
+void SignalBase::disconnect(SlotNode* node) {
+	if(Trackable* t = node->trackable) {
+		if(node->trackPrev)
+			node->trackPrev->trackNext = node->trackNext;
+		else
+			t->tracked = node->trackNext;
+		if(node->trackNext)
+			node->trackNext->trackPrev = node->trackPrev;
+		node->trackable = 0;
+		node->trackNext = node->trackPrev = 0;
+	}
+
+	node->signal = 0;
+	count--;
+	if(dispatching)
+		needsCleanup = true;
+	else
+		unlink(node);
+}
+
+/**
+ * Remove a node from the list and drop the list's reference to it.
+ */
+void SignalBase::unlink(SlotNode* node) {
+	if(node->prev)
+		node->prev->next = node->next;
+	else
+		head = node->next;
+	if(node->next)
+		node->next->prev = node->prev;
+	else
+		tail = node->prev;
+	node->release();
+}
+
+/**
+ * Remove nodes disconnected while firing.
+ */
+void SignalBase::cleanup() {
+	needsCleanup = false;
+	SlotNode* n = head;
+	while(n) {
+		SlotNode* next = n->next;
+		if(!n->signal)
+			unlink(n);
+		n = next;
+	}
+}
@@ -0,0 +1,337 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIGNAL_H_
+#define SIGNAL_H_
+
+#include <boost/bind.hpp>
+
+namespace urt {
+
+class Trackable;
+class Connection;
+
+namespace detail {
+
+class SignalBase;
+
+/**
+ * A connected slot. Each node is linked into the list of the signal it is connected to and, if it is tracking an object,
+ * into that Trackable's list as well. Derived classes (see Signal) store the callable itself, so a connection costs a
+ * single allocation and invoking it costs a single virtual call.
+ */
+class SlotNode {
+public:
+	SlotNode() : signal(0), next(0), prev(0), trackable(0), trackNext(0), trackPrev(0), refs(0) {}
+	virtual ~SlotNode() {}
+	/** Drop a reference, deleting the node once none remain. */
+	void release() { if(--refs == 0) delete this; }
+
+	SignalBase* signal; ///< Signal connected to; NULL once disconnected
+	SlotNode* next; ///< Next slot of signal
+	SlotNode* prev; ///< Previous slot of signal
+	Trackable* trackable; ///< Object whose destruction disconnects the slot, if any
+	SlotNode* trackNext; ///< Next slot tracking the same object
+	SlotNode* trackPrev; ///< Previous slot tracking the same object
+	unsigned int refs; ///< References held by the signal and by Connection objects
+private:
+	SlotNode(const SlotNode&); //not copyable
+	SlotNode& operator=(const SlotNode&); //not copyable
+};
+
+/**
+ * Slot list management shared by all Signal specializations.
+ */
+class SignalBase {
+public:
+	/** @return true if no slots are connected */
+	bool empty() const { return count == 0; }
+	/** @return number of slots connected */
+	unsigned int size() const { return count; }
+	void disconnectAll();
+protected:
+	SignalBase() : head(0), tail(0), count(0), dispatching(0), needsCleanup(false) {}
+	/** Copies of a signal have no slots; slots stay with the original. */
+	SignalBase(const SignalBase&) : head(0), tail(0), count(0), dispatching(0), needsCleanup(false) {}
+	SignalBase& operator=(const SignalBase&) { return *this; }
+	~SignalBase() { disconnectAll(); }
+
+	Connection link(SlotNode* node, Trackable* trackable);
+
+	/** Keeps disconnected nodes in place while the signal is being fired. */
+	class Dispatch {
+	public:
+		explicit Dispatch(SignalBase& s) : s(s) { ++s.dispatching; }
+		~Dispatch() { if(--s.dispatching == 0 && s.needsCleanup) s.cleanup(); }
+	private:
+		SignalBase& s;
+	};
+
+	SlotNode* head; ///< First slot
+private:
+	friend class urt::Connection;
+	friend class urt::Trackable;
+	void disconnect(SlotNode* node);
+	void unlink(SlotNode* node);
+	void cleanup();
+
+	SlotNode* tail; ///< Last slot; new slots are called last
+	unsigned int count; ///< Number of connected slots
+	unsigned int dispatching; ///< Depth of (possibly nested) firing in progress
+	bool needsCleanup; ///< True if nodes were disconnected while firing
+};
+
+}
+
+/**
+ * Base class for objects whose member functions are connected to a Signal. When the object is destroyed, every such
+ * connection made with it as the tracked object is automatically disconnected, so the slot is never called on a dead
+ * object. FDEvtSource derives from Trackable.
+ *
+ * Copying a Trackable does not copy its connections.
+ */
+class Trackable {
+public:
+	Trackable() : tracked(0) {}
+	Trackable(const Trackable&) : tracked(0) {}
+	Trackable& operator=(const Trackable&) { return *this; }
+protected:
+	~Trackable();
+private:
+	friend class detail::SignalBase;
+	detail::SlotNode* tracked; ///< First slot tracking this object
+};
+
+/**
+ * Refers to a slot connected to a Signal, permitting it to be disconnected. Ignoring the Connection returned by
+ * Signal::connect() is fine; the slot remains connected until explicitly disconnected, its tracked object is destroyed,
+ * or the signal is destroyed.
+ */
+class Connection {
+public:
+	Connection() : node(0) {}
+	Connection(const Connection& c) : node(c.node) { if(node) node->refs++; }
+	Connection& operator=(const Connection& c) {
+		if(c.node) c.node->refs++;
+		if(node) node->release();
+		node = c.node;
+		return *this;
+	}
+	~Connection() { if(node) node->release(); }
+
+	/** Disconnect the slot. Does nothing if already disconnected. Safe to call from within a slot. */
+	void disconnect() { if(node && node->signal) node->signal->disconnect(node); }
+	/** @return true if the slot is still connected */
+	bool connected() const { return node && node->signal; }
+private:
+	friend class detail::SignalBase;
+	explicit Connection(detail::SlotNode* n) : node(n) { node->refs++; }
+	detail::SlotNode* node;
+};
+
+inline Connection detail::SignalBase::link(SlotNode* node, Trackable* trackable) {
+	node->signal = this;
+	node->refs++; //held by the list
+	node->prev = tail;
+	if(tail)
+		tail->next = node;
+	else
+		head = node;
+	tail = node;
+	count++;
+
+	if(trackable) {
+		node->trackable = trackable;
+		node->trackNext = trackable->tracked;
+		if(trackable->tracked)
+			trackable->tracked->trackPrev = node;
+		trackable->tracked = node;
+	}
+	return Connection(node);
+}
+
+/**
+ * URT's signal-slot mechanism. A Signal holds any number of slots (functions, functors, or member functions of an
+ * object) and calls each of them, in the order they were connected, when fired with operator(). It is specialized for
+ * signatures of zero to two parameters returning void: e.g., <tt>Signal<void (const std::string&, const std::string&)></tt>.
+ *
+ * Slots may be connected or disconnected (including themselves) while the signal is being fired. Slots connected
+ * during firing may or may not be called by that firing. Copying a signal produces a signal with no slots.
+ *
+ * @note Not thread safe, like the rest of URT.
+ */
+template<typename Signature>
+class Signal;
+
+/** @see Signal */
+template<>
+class Signal<void ()> : public detail::SignalBase {
+	struct Node : detail::SlotNode {
+		virtual void call() = 0;
+	};
+	template<class F>
+	struct Impl : Node {
+		explicit Impl(const F& f) : f(f) {}
+		void call() { f(); }
+		F f;
+	};
+public:
+	/**
+	 * Anything callable as a slot: a function, functor, or bound member function. Implicitly constructed from
+	 * any of them, so they may be passed directly to functions taking a slot_type.
+	 */
+	class slot_type {
+	public:
+		template<class F>
+		slot_type(const F& f) : node(new Impl<F>(f)) {}
+		slot_type(void (*f)()) : node(new Impl<void (*)()>(f)) {}
+		slot_type(const slot_type& s) : node(s.node) { s.node = 0; }
+		~slot_type() { delete node; }
+	private:
+		friend class Signal;
+		slot_type& operator=(const slot_type&); //not assignable
+		mutable Node* node;
+	};
+
+	/**
+	 * Connect a slot.
+	 * @param slot slot to call
+	 * @param trackable if not NULL, the slot is disconnected when this object is destroyed
+	 * @return connection
+	 */
+	Connection connect(const slot_type& slot, Trackable* trackable = 0) {
+		Node* n = slot.node;
+		slot.node = 0;
+		return link(n, trackable);
+	}
+	/**
+	 * Connect a member function, disconnecting it automatically when \c obj is destroyed.
+	 * @param ptrMemFunc pointer to member function
+	 * @param obj object whose function to call; must be derived from Trackable
+	 * @return connection
+	 */
+	template<class T>
+	Connection connect(void (T::*ptrMemFunc)(), T& obj) {
+		return connect(boost::bind(ptrMemFunc, &obj), &static_cast<Trackable&>(obj));
+	}
+	/** Call every connected slot. */
+	void operator()() {
+		Dispatch d(*this);
+		for(detail::SlotNode* n = head; n; n = n->next)
+			if(n->signal)
+				static_cast<Node*>(n)->call();
+	}
+};
+
+/** @see Signal */
+template<typename A1>
+class Signal<void (A1)> : public detail::SignalBase {
+	struct Node : detail::SlotNode {
+		virtual void call(A1 a1) = 0;
+	};
+	template<class F>
+	struct Impl : Node {
+		explicit Impl(const F& f) : f(f) {}
+		void call(A1 a1) { f(a1); }
+		F f;
+	};
+public:
+	/** @see Signal<void ()>::slot_type */
+	class slot_type {
+	public:
+		template<class F>
+		slot_type(const F& f) : node(new Impl<F>(f)) {}
+		slot_type(void (*f)(A1)) : node(new Impl<void (*)(A1)>(f)) {}
+		slot_type(const slot_type& s) : node(s.node) { s.node = 0; }
+		~slot_type() { delete node; }
+	private:
+		friend class Signal;
+		slot_type& operator=(const slot_type&); //not assignable
+		mutable Node* node;
+	};
+
+	/** @see Signal<void ()>::connect(const slot_type&, Trackable*) */
+	Connection connect(const slot_type& slot, Trackable* trackable = 0) {
+		Node* n = slot.node;
+		slot.node = 0;
+		return link(n, trackable);
+	}
+	/** @see Signal<void ()>::connect(void (T::*)(), T&) */
+	template<class T>
+	Connection connect(void (T::*ptrMemFunc)(A1), T& obj) {
+		return connect(boost::bind(ptrMemFunc, &obj, _1), &static_cast<Trackable&>(obj));
+	}
+	/** Call every connected slot. */
+	void operator()(A1 a1) {
+		Dispatch d(*this);
+		for(detail::SlotNode* n = head; n; n = n->next)
+			if(n->signal)
+				static_cast<Node*>(n)->call(a1);
+	}
+};
+
+/** @see Signal */
+template<typename A1, typename A2>
+class Signal<void (A1, A2)> : public detail::SignalBase {
+	struct Node : detail::SlotNode {
+		virtual void call(A1 a1, A2 a2) = 0;
+	};
+	template<class F>
+	struct Impl : Node {
+		explicit Impl(const F& f) : f(f) {}
+		void call(A1 a1, A2 a2) { f(a1, a2); }
+		F f;
+	};
+public:
+	/** @see Signal<void ()>::slot_type */
+	class slot_type {
+	public:
+		template<class F>
+		slot_type(const F& f) : node(new Impl<F>(f)) {}
+		slot_type(void (*f)(A1, A2)) : node(new Impl<void (*)(A1, A2)>(f)) {}
+		slot_type(const slot_type& s) : node(s.node) { s.node = 0; }
+		~slot_type() { delete node; }
+	private:
+		friend class Signal;
+		slot_type& operator=(const slot_type&); //not assignable
+		mutable Node* node;
+	};
+
+	/** @see Signal<void ()>::connect(const slot_type&, Trackable*) */
+	Connection connect(const slot_type& slot, Trackable* trackable = 0) {
+		Node* n = slot.node;
+		slot.node = 0;
+		return link(n, trackable);
+	}
+	/** @see Signal<void ()>::connect(void (T::*)(), T&) */
+	template<class T>
+	Connection connect(void (T::*ptrMemFunc)(A1, A2), T& obj) {
+		return connect(boost::bind(ptrMemFunc, &obj, _1, _2), &static_cast<Trackable&>(obj));
+	}
+	/** Call every connected slot. */
+	void operator()(A1 a1, A2 a2) {
+		Dispatch d(*this);
+		for(detail::SlotNode* n = head; n; n = n->next)
+			if(n->signal)
+				static_cast<Node*>(n)->call(a1, a2);
+	}
+};
+
+}
+
+#endif /* SIGNAL_H_ */
@@ -20,8 +20,8 @@
 
 using namespace urt;
 
-void SlottedTimer::registerSlot(const boost::signal<void ()>::slot_type& slot) {
-	signal.connect(slot);
+Connection SlottedTimer::registerSlot(const Signal<void ()>::slot_type& slot) {
+	return signal.connect(slot);
 }
 
 bool SlottedTimer::onTimeout() {
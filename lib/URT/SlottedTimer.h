@@ -22,7 +22,7 @@
 #include "Timer.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
-#include <boost/signal.hpp>
+#include "Signal.h"
 #include <boost/bind.hpp>
 
 namespace urt {
@@ -37,8 +37,9 @@ public:
 	/** Construct a SlottedTimer.
 	  * @param millis Timeout in milliseconds.
 	  * @param start If true, timer starts counting immediately after construction.
+	  * @param backend Mechanism used to keep time.
 	  */
-	SlottedTimer(int millis, bool start = true) : Timer(millis, start) {}
+	SlottedTimer(int millis, bool start = true, Backend backend = LOOP) : Timer(millis, start, backend) {}
 	
 	/**
 	 * Registers all slots except for non-static class member functions.
@@ -47,10 +48,11 @@ public:
 	 * @param slot pointer to non-member function, functor (object that overloads operator()),
 	 * 	or static member function
 	 *
-	 * @note If the slot is a functor, it cannot be derived from boost::signals::trackable.
+	 * @note Functors are copied and never tracked. For automatic disconnection, use the member function overload.
+	 * @return connection, which may be used to unregister the slot
 	 * @see State::registerSlot
 	 */
-	void registerSlot(const boost::signal<void ()>::slot_type& slot);
+	Connection registerSlot(const Signal<void ()>::slot_type& slot);
 	/**
 	 * Registers class member functions with associated object as a slot.
 	 * The slot is called at least every timeout duration. The slot will be automatically unregistered if the
@@ -58,29 +60,28 @@ public:
 	 *
 	 * @param ptrMemFunc pointer to a member function
 	 * @param obj object whose function to call
-	 * @tparam T type of object to associate with slot
+	 * @tparam T type of object to associate with slot; must be derived from Trackable
+	 * @return connection, which may be used to unregister the slot
 	 *
 	 * @see State::registerSlot
 	 */
 	template<class T>
-	inline void registerSlot(void (T::*ptrMemFunc)(), T& obj) {
-		//The reason for casting to boost::signals::trackable and back to T is to enforce
-		//the requirement that T be derived from boost::signals::trackable.
-		//If you get an error here, it is because you are trying to violate that requirement.
-		registerSlot(boost::bind(ptrMemFunc, &static_cast<T&>(static_cast<boost::signals::trackable&>(obj))));
+	inline Connection registerSlot(void (T::*ptrMemFunc)(), T& obj) {
+		return signal.connect(ptrMemFunc, obj);
 	}
 	/**
 	 * Convenience function which enables using a boost::weak_ptr (EvtSourcePtr) instead of a reference.
 	 * @overload
 	 */
 	template<class T>
-	inline void registerSlot(void (T::*ptrMemFunc)(), boost::weak_ptr<T> ptr) {
+	inline Connection registerSlot(void (T::*ptrMemFunc)(), boost::weak_ptr<T> ptr) {
 		if(boost::shared_ptr<T> p = ptr.lock())
-			registerSlot(ptrMemFunc, *p);
+			return registerSlot(ptrMemFunc, *p);
+		return Connection();
 	}
 private:
 	bool onTimeout();
-	boost::signal<void ()> signal;
+	Signal<void ()> signal;
 };
 
 }
@@ -28,6 +28,7 @@
 #include <strings.h> //bzero
 #include <arpa/inet.h> //inet_addr
 #include <poll.h>
+#include <errno.h>
 
 namespace urt {
 
@@ -64,6 +65,15 @@ bool Socket::IsOk()
 
 void Socket::send(const void* buf, ssize_t size) throw (SocketException)
 {
+	if(queuedWrites)
+	{
+		if(!queueWrite(buf, size))
+		{
+			okay = false;
+			throw SocketException("Error sending data");
+		}
+		return;
+	}
 	ssize_t t = write(fdesc, buf, size);
 	if(t < 0 || t != size)
 	{
@@ -71,6 +81,37 @@ void Socket::send(const void* buf, ssize_t size) throw (SocketException)
 		throw SocketException("Error sending data");
 	}
 }
+void Socket::send(const iovec* iov, int count) throw (SocketException)
+{
+	if(queuedWrites)
+	{
+		if(!queueWrite(iov, count))
+		{
+			okay = false;
+			throw SocketException("Error sending data");
+		}
+		return;
+	}
+	ssize_t size = 0;
+	for(int i = 0; i < count; i++)
+		size += iov[i].iov_len;
+	ssize_t t = writev(fdesc, iov, count);
+	if(t < 0 || t != size)
+	{
+		okay = false;
+		throw SocketException("Error sending data");
+	}
+}
+/**
+ * Writes without blocking, even though the socket itself is blocking, and without raising SIGPIPE.
+ */
+ssize_t Socket::writeSome(const iovec* iov, int count)
+{
+	msghdr msg = msghdr();
+	msg.msg_iov = const_cast<iovec*>(iov);
+	msg.msg_iovlen = count;
+	return sendmsg(fdesc, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
 size_t Socket::get(void* buf, ssize_t size) throw (SocketException)
 {
 	ssize_t t = recv(fdesc, buf, size, MSG_WAITALL);
@@ -81,5 +122,19 @@ size_t Socket::get(void* buf, ssize_t size) throw (SocketException)
 	}
 	return t;
 }
+size_t Socket::getAvailable(void* buf, size_t size) throw (SocketException)
+{
+	if(!size)
+		return 0;
+	ssize_t t = recv(fdesc, buf, size, MSG_DONTWAIT);
+	if(t < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	if(t <= 0)
+	{
+		okay = false;
+		throw SocketException("Error getting data");
+	}
+	return t;
+}
 
 }
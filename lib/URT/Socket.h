@@ -30,6 +30,7 @@
 #include "urtexcept.h"
 
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 namespace urt {
 
@@ -70,12 +71,20 @@ public:
 	virtual ~Socket();
 
 	/**
-	 * Send data to server.
+	 * Send data to server. If \c queuedWrites is set, the data is queued rather than sent synchronously
+	 * (see FDEvtSource::queueWrite).
 	 * @param buf pointer to data to send
 	 * @param size size of buffer to send in bytes
 	 * @throws SocketException thrown when error sending data
 	 */
 	void send(const void* buf, ssize_t size) throw (SocketException);
+	/**
+	 * Send data gathered from several buffers with a single system call.
+	 * @param iov buffers to send, in order
+	 * @param count number of buffers
+	 * @throws SocketException thrown when error sending data
+	 */
+	void send(const iovec* iov, int count) throw (SocketException);
 	/**
 	 * Receive data from server.
 	 * @param buf pointer to buffer in which to save data
@@ -84,12 +93,23 @@ public:
 	 * @throws SocketException thrown when error receiving data
 	 */
 	size_t get(void* buf, ssize_t size) throw (SocketException);
+	/**
+	 * Receive whatever data is available without blocking.
+	 * @param buf pointer to buffer in which to save data
+	 * @param size size of buffer
+	 * @return number of bytes received; 0 if none are available
+	 * @throws SocketException thrown when the connection was closed or on error
+	 */
+	size_t getAvailable(void* buf, size_t size) throw (SocketException);
 	/**
 	 * Determines if socket is alive and okay.
 	 * @return true if okay
 	 */
 	bool IsOk();
 
+protected:
+	ssize_t writeSome(const iovec* iov, int count);
+
 private:
 	bool okay;
 	sockaddr_in addr;
@@ -24,34 +24,218 @@
  */
 
 #include "State.h"
+#include "Log.h"
+#include <limits>
 
 namespace urt {
 
 
-boost::unordered_map<std::string, State::Substate> State::substates;
+std::deque<State::Substate> State::substates;
+boost::unordered_map<std::string, size_t> State::indices;
+unsigned int State::batchDepth = 0;
+std::vector<size_t> State::pending;
+Signal<void (SubstateHandle)> State::changeSignal;
+
+SubstateHandle State::resolve(const std::string& key) {
+	std::pair<boost::unordered_map<std::string, size_t>::iterator, bool> r = indices.insert(std::make_pair(key, substates.size()));
+	if(r.second) {
+		substates.push_back(Substate());
+		substates.back().key = key;
+	}
+	return SubstateHandle(r.first->second);
+}
 
 void State::setSignalOnTouch(const std::string& key, bool v) {
-	substates[key].signalOnTouch = v;
+	setSignalOnTouch(resolve(key), v);
+}
+
+/**
+ * Find a substate without creating it.
+ * @return substate with given key, or an unset substate if it does not exist
+ */
+const State::Substate& State::lookup(const std::string& key) {
+	static const Substate unset;
+	boost::unordered_map<std::string, size_t>::const_iterator i = indices.find(key);
+	if(i == indices.end())
+		return unset;
+	return substates[i->second];
+}
+
+/**
+ * @return value in string form, generating it if necessary
+ */
+const std::string& State::Substate::text() const {
+	if(!textValid) {
+		switch(type) {
+			case INT:    data = boost::lexical_cast<std::string>(number.i); break;
+			case DOUBLE: data = boost::lexical_cast<std::string>(number.d); break;
+			case BOOL:   data = number.b ? "1" : "0"; break;
+			default: break;
+		}
+		textValid = true;
+	}
+	return data;
+}
+
+long State::toLong(const Substate& s) {
+	switch(s.type) {
+		case INT:
+			return s.number.i;
+		case BOOL:
+			return s.number.b;
+		case DOUBLE:
+			//any whole number that fits in a long. This accepts more than lexical_cast<long> of the text form would,
+			//which rejects whole numbers printed in exponent form (e.g., 1e17 as "1e+17").
+			//The upper bound is -min() (2^63 with a 64-bit long) since max() is not exactly representable as a double.
+			if(s.number.d >= std::numeric_limits<long>::min() && s.number.d < -static_cast<double>(std::numeric_limits<long>::min())
+					&& s.number.d == static_cast<double>(static_cast<long>(s.number.d)))
+				return static_cast<long>(s.number.d);
+			throw boost::bad_lexical_cast(typeid(double), typeid(long));
+		default:
+			return boost::lexical_cast<long>(s.data);
+	}
+}
+
+double State::toDouble(const Substate& s) {
+	switch(s.type) {
+		case INT:    return s.number.i;
+		case BOOL:   return s.number.b;
+		case DOUBLE: return s.number.d;
+		default:     return boost::lexical_cast<double>(s.data);
+	}
+}
+
+bool State::toBool(const Substate& s) {
+	switch(s.type) {
+		case BOOL:
+			return s.number.b;
+		case INT:
+			if(s.number.i == 0 || s.number.i == 1)
+				return s.number.i;
+			throw boost::bad_lexical_cast(typeid(long), typeid(bool));
+		case DOUBLE:
+			if(s.number.d == 0 || s.number.d == 1)
+				return s.number.d != 0;
+			throw boost::bad_lexical_cast(typeid(double), typeid(bool));
+		default:
+			return boost::lexical_cast<bool>(s.data);
+	}
 }
 
 std::string State::get(const std::string & key)
 {
-	return substates[key].data;
+	return lookup(key).text();
 }
 
-void State::set(const std::string & key, const std::string & value)
+/**
+ * Call the slots of a substate that was just set, or queue them if within a batch.
+ * @param h substate set
+ * @param changed true if the value differs from the previous one
+ */
+void State::notify(SubstateHandle h, bool changed)
 {
-	if(substates[key].data != value)
+	Substate& s = substates[h.index];
+	if(!changed && !s.signalOnTouch)
+		return;
+	if(batchDepth > 0) {
+		if(!s.pending) {
+			s.pending = true;
+			pending.push_back(h.index);
+		}
+		return;
+	}
+	fire(h);
+}
+
+/**
+ * Call the slots of a substate with its current value.
+ */
+void State::fire(SubstateHandle h)
+{
+	Substate& s = substates[h.index];
+	if(!s.signal.empty())
+		s.signal(s.key, s.text()); //call all of the signals
+	if(!s.valueSignal.empty())
+		s.valueSignal(h);
+	if(!changeSignal.empty())
+		changeSignal(h);
+}
+
+void State::commit()
+{
+	if(batchDepth == 0 || --batchDepth > 0)
+		return;
+
+	//Take the list first: slots run outside the batch, and any batch they start gets a list of its own.
+	std::vector<size_t> queued;
+	queued.swap(pending);
+	for(std::vector<size_t>::iterator i = queued.begin(); i < queued.end(); i++)
+		substates[*i].pending = false;
+	for(std::vector<size_t>::iterator i = queued.begin(); i < queued.end(); i++)
 	{
-		substates[key].data = value;
-		(*substates[key].signal)(key, value); //call all of the signals
-	} else if(substates[key].signalOnTouch)
-		(*substates[key].signal)(key, value); //call all of the signals
+		//commit() often runs where nothing can handle an exception (such as the end of an EventLoop iteration or
+		//Batch's destructor), and one failing slot must not keep the rest of the batch from being notified
+		try
+		{
+			fire(SubstateHandle(*i));
+		}
+		catch(std::exception& e)
+		{
+			Log::error(std::string("slot called on State commit threw: ") + e.what());
+		}
+	}
+}
+
+void State::set(SubstateHandle h, const std::string & value)
+{
+	Substate& s = substates[h.index];
+	const bool changed = (s.text() != value);
+	s.type = STRING;
+	s.data = value;
+	s.textValid = true;
+	notify(h, changed);
+}
+
+void State::set(SubstateHandle h, long value)
+{
+	Substate& s = substates[h.index];
+	//comparing against a value of another type has to be done in string form, as before
+	const bool changed = (s.type == INT) ? (s.number.i != value) : (s.text() != boost::lexical_cast<std::string>(value));
+	s.type = INT;
+	s.number.i = value;
+	s.textValid = false;
+	notify(h, changed);
+}
+
+void State::set(SubstateHandle h, double value)
+{
+	Substate& s = substates[h.index];
+	const bool changed = (s.type == DOUBLE) ? (s.number.d != value) : (s.text() != boost::lexical_cast<std::string>(value));
+	s.type = DOUBLE;
+	s.number.d = value;
+	s.textValid = false;
+	notify(h, changed);
+}
+
+void State::set(SubstateHandle h, bool value)
+{
+	Substate& s = substates[h.index];
+	const bool changed = (s.type == BOOL) ? (s.number.b != value) : (s.text() != (value ? "1" : "0"));
+	s.type = BOOL;
+	s.number.b = value;
+	s.textValid = false;
+	notify(h, changed);
 }
 
-void State::registerSlot(const std::string& key, const boost::signal<void (const std::string&, const std::string&)>::slot_type& slot)
+void State::setBlob(SubstateHandle h, const void* data, size_t size)
 {
-	substates[key].signal->connect(slot);
+	Substate& s = substates[h.index];
+	const char* bytes = static_cast<const char*>(data);
+	const bool changed = (s.text().size() != size || s.data.compare(0, size, bytes, size) != 0);
+	s.type = BLOB;
+	s.data.assign(bytes, size);
+	s.textValid = true;
+	notify(h, changed);
 }
 
 
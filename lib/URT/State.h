@@ -27,16 +27,43 @@
 #define STATE_H_
 
 #include <map>
+#include <deque>
+#include <vector>
 #include <string>
-#include <boost/signal.hpp>
+#include "Signal.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/bind.hpp>
 #include <boost/unordered_map.hpp> //hash map
 #include <boost/lexical_cast.hpp>
+#include <boost/utility.hpp>
+#include <typeinfo>
 
 namespace urt {
 
+/**
+ * A stable reference to a substate, obtained once from State::resolve(). Passing a handle to State instead of a key
+ * avoids hashing (and possibly copying) the key on every call and, unlike State::get(const std::string&), can never
+ * create a substate by accident. Handles remain valid for the life of the program.
+ *
+ * A default-constructed handle refers to no substate; using it with State is undefined. Assign it from
+ * State::resolve() first.
+ */
+class SubstateHandle {
+public:
+	SubstateHandle() : index(static_cast<size_t>(-1)) {}
+	/** @return true if the handle refers to a substate */
+	bool valid() const { return index != static_cast<size_t>(-1); }
+	bool operator==(const SubstateHandle& h) const { return index == h.index; }
+	bool operator!=(const SubstateHandle& h) const { return index != h.index; }
+	/** Orders handles arbitrarily (by creation) so they can be used as keys of sorted containers. */
+	bool operator<(const SubstateHandle& h) const { return index < h.index; }
+private:
+	friend class State;
+	explicit SubstateHandle(size_t i) : index(i) {}
+	size_t index; ///< Position of the substate in State's storage
+};
+
 /**
  * The State static class keeps track of all the different states of the machine at any given time.
  * It does so dynamically, using a map to store keyed data. The general idea is that
@@ -49,10 +76,13 @@ namespace urt {
  * Instead, all member functions and variables are declared static. In a sense, this makes State a global
  * class object. There is only one State, and it persists throughout execution.
  *
- * A Substate consists of a string key and a string value. Numerical value types (int, double, etc.) were
- * considered but rejected due to the additional complexity and the difficultly in transmitting numbers
- * across different platforms with possible differences in endianness. Only one value exists per state;
- * attempting to insert/set a key-value pair will replace a previous key-value pair that had the same key.
+ * A Substate consists of a string key and a value. Only one value exists per state; attempting to insert/set a
+ * key-value pair will replace a previous key-value pair that had the same key. Values are always available in string
+ * form, which is what is transmitted to remote devices (avoiding differences in endianness across platforms). However,
+ * integers, doubles, and bools set through the typed set() overloads are stored natively, and their string form is
+ * only generated when something actually asks for it (get(), a string slot, etc.). getAs() converts directly from the
+ * stored type where it can, so numeric producers and consumers never format or parse text. Conversions behave exactly
+ * as the equivalent round trip through boost::lexical_cast would. Arbitrary binary data can be stored with setBlob().
  *
  * The State class also enables the use of signals, which enables client code to tell the system to trigger
  * a function (called a slot) when there is a change to State. Generally speaking, this won't be used too often, since data
@@ -62,9 +92,90 @@ namespace urt {
  * they are finished. It is important, therefore, to not get stuck in a signal-invoking loop which never
  * returns control back to the handler and event loop; this could happen if the client code invoked on a signal
  * alters the state again, triggering another signal. (Pro tip: use signals sparingly and only when necessary).
+ *
+ * Notification can be deferred by grouping changes into a batch with beginBatch() and commit() (or a State::Batch
+ * object). Within a batch, values are updated immediately, but slots are not called until the outermost batch is
+ * committed, at which point each affected substate's slots are called once with its latest value. An EventLoop can
+ * be told to wrap each of its iterations in a batch (see EventLoop::setStateBatching()).
+ *
+ * Code that accesses the same substates repeatedly (e.g., every EventLoop interval) should resolve their keys once
+ * with resolve() and use the SubstateHandle overloads thereafter; these index directly into the substate storage.
+ * Resolve keys in a constructor, as below, or on first use in a function; a handle initialized at namespace scope may
+ * be resolved before State itself has been initialized.
+ *
+ * @code
+ * class Navigator {
+ * public:
+ * 		Navigator() : compass(urt::State::resolve("compass")) {}
+ * 		int heading() const { return urt::State::getAs<int>(compass); }
+ * private:
+ * 		const urt::SubstateHandle compass;
+ * };
+ * @endcode
  */
 class State {
 public:
+	/**
+	 * Batches State changes for the lifetime of the object.
+	 * @code
+	 * {
+	 * 		urt::State::Batch batch;
+	 * 		urt::State::set(lat, latitude);
+	 * 		urt::State::set(lon, longitude);
+	 * } //slots for lat and lon are called here
+	 * @endcode
+	 * @note Slots that throw a std::exception when the batch is committed are logged and do not prevent the remaining
+	 * 	slots from being called (see commit()).
+	 */
+	class Batch : boost::noncopyable {
+	public:
+		Batch() { beginBatch(); }
+		~Batch() { commit(); }
+	};
+
+	/**
+	 * Begin deferring slot invocation. Batches may be nested; slots are only called when the outermost batch is
+	 * committed.
+	 */
+	static void beginBatch() { ++batchDepth; }
+	/**
+	 * End a batch begun with beginBatch(). If this ends the outermost batch, the slots of every substate that changed
+	 * (or was touched, see setSignalOnTouch()) are called once each, with the substate's latest value, in the order the
+	 * substates were first changed. Changes made by those slots notify immediately. A slot that throws a std::exception
+	 * is logged rather than propagating it, and the remaining slots are still called.
+	 */
+	static void commit();
+	/** @return true if within a batch */
+	static bool inBatch() { return batchDepth > 0; }
+
+	/**
+	 * Get a handle to a substate, creating the substate (unset) if it does not yet exist.
+	 * @param key substate's key
+	 * @return handle to substate, valid for the life of the program
+	 */
+	static SubstateHandle resolve(const std::string& key);
+	/**
+	 * Get the key of a substate.
+	 * @param h substate's handle
+	 * @return substate's key
+	 */
+	static const std::string& getKey(SubstateHandle h) { return substates[h.index].key; }
+
+	/** How a substate's value is stored. */
+	enum Type {
+		STRING,	///< Text; also the type of unset substates
+		BLOB,	///< Arbitrary bytes; string form is the bytes themselves
+		INT,	///< Integer (long)
+		DOUBLE,	///< Floating point
+		BOOL	///< Boolean; string form is "0" or "1"
+	};
+	/**
+	 * Get how a substate's value is stored.
+	 * @param h substate's handle
+	 * @return type of most recently set value
+	 */
+	static Type getType(SubstateHandle h) { return substates[h.index].type; }
+
 	/**
 	 * Set whether a substate's signal will be triggered if it is just touched (i.e., set to its already set value) and not
 	 * 	changed.
@@ -72,15 +183,44 @@ public:
 	 * @param v if true, \b all slots associated with the substate signal will fire on touches
 	 */
 	static void setSignalOnTouch(const std::string& key, bool v);
+	/** @overload */
+	static void setSignalOnTouch(SubstateHandle h, bool v) { substates[h.index].signalOnTouch = v; }
 
 	/**
 	 * Set a substate.
 	 * @param key substate's key
 	 * @param value substate's value
 	 */
-	static void set(const std::string& key, const std::string& value);
+	static void set(const std::string& key, const std::string& value) { set(resolve(key), value); }
+	/**
+	 * Set a substate.
+	 * @param h substate's handle
+	 * @param value substate's value
+	 */
+	static void set(SubstateHandle h, const std::string& value);
 	/**
-	 * Set a substate, converting argument to string.
+	 * Set a substate to an integer without converting it to a string.
+	 * @param h substate's handle
+	 * @param value substate's value
+	 */
+	static void set(SubstateHandle h, long value);
+	/** @overload */
+	static void set(SubstateHandle h, int value) { set(h, static_cast<long>(value)); }
+	/** @overload */
+	static void set(SubstateHandle h, double value);
+	/** @overload */
+	static void set(SubstateHandle h, bool value);
+	/**
+	 * Set a substate to binary data.
+	 * @param h substate's handle
+	 * @param data bytes to store
+	 * @param size number of bytes
+	 */
+	static void setBlob(SubstateHandle h, const void* data, size_t size);
+	/** @overload */
+	static void setBlob(const std::string& key, const void* data, size_t size) { setBlob(resolve(key), data, size); }
+	/**
+	 * Set a substate. Integers, doubles, and bools are stored natively; other types are converted to string.
 	 * @tparam T type of value
 	 * @param key substate's key
 	 * @param value substate's value
@@ -88,14 +228,26 @@ public:
 	 */
 	template<typename T>
 	inline static void set(const std::string& key, const T& value) {
-		set(key, boost::lexical_cast<std::string>(value));
+		set(resolve(key), value);
+	}
+	/** @overload */
+	template<typename T>
+	inline static void set(SubstateHandle h, const T& value) {
+		set(h, boost::lexical_cast<std::string>(value));
 	}
 	/**
-	 * Get a substate.
+	 * Get a substate. Does not create the substate if it does not exist.
 	 * @param key substate's key
 	 * @return substate's value; empty string if not set
 	 */
 	static std::string get(const std::string& key);
+	/**
+	 * Get a substate without copying its value.
+	 * @param h substate's handle
+	 * @return substate's value; empty string if not set. The reference remains valid, but its contents change
+	 * 	when the substate is set.
+	 */
+	static const std::string& get(SubstateHandle h) { return substates[h.index].text(); }
 	/**
 	 * Get a substate as a particular type.
 	 * @tparam T type to return
@@ -105,7 +257,7 @@ public:
 	 */
 	template<typename T>
 	inline static T getAs(const std::string& key) throw (boost::bad_lexical_cast) {
-		return boost::lexical_cast<T>(get(key));
+		return Converter<T>::get(lookup(key));
 	}
 	/**
 	 * Get a substate as a particular type. Returns a default value if unset.
@@ -117,11 +269,25 @@ public:
 	 */
 	template<typename T>
 	inline static T getAs(const std::string& key, T unset) throw (boost::bad_lexical_cast) {
-		const std::string t = get(key);
-		if(t.empty())
+		const Substate& s = lookup(key);
+		if(s.empty())
 			return unset;
 		else
-			return boost::lexical_cast<T>(t);
+			return Converter<T>::get(s);
+	}
+	/** @overload */
+	template<typename T>
+	inline static T getAs(SubstateHandle h) throw (boost::bad_lexical_cast) {
+		return Converter<T>::get(substates[h.index]);
+	}
+	/** @overload */
+	template<typename T>
+	inline static T getAs(SubstateHandle h, T unset) throw (boost::bad_lexical_cast) {
+		const Substate& s = substates[h.index];
+		if(s.empty())
+			return unset;
+		else
+			return Converter<T>::get(s);
 	}
 	/**
 	 * Registers all slots except for non-static class member functions.
@@ -134,7 +300,9 @@ public:
 	 * @param slot pointer to non-member function, functor (object that overloads operator()(const std::string&, const std::string&),
 	 * 	or static member function
 	 *
-	 * @note If the slot is a functor, it cannot be derived from boost::signals::trackable.
+	 * @return connection, which may be used to unregister the slot
+	 *
+	 * @note Functors are copied and never tracked. For automatic disconnection, use the member function overload.
 	 *
 	 * @code
 	 * void announce(const std::string& key, const std::string& value) {
@@ -151,7 +319,13 @@ public:
 	 * }
 	 * @endcode
 	 */
-	static void registerSlot(const std::string& key, const boost::signal<void (const std::string&, const std::string&)>::slot_type& slot);
+	static Connection registerSlot(const std::string& key, const Signal<void (const std::string&, const std::string&)>::slot_type& slot) {
+		return registerSlot(resolve(key), slot);
+	}
+	/** @overload */
+	static Connection registerSlot(SubstateHandle h, const Signal<void (const std::string&, const std::string&)>::slot_type& slot) {
+		return substates[h.index].signal.connect(slot);
+	}
 	/**
 	 * Registers class member functions with associated object as a slot.
 	 * The slot is called whenever the state for the given key <i>changes</i>
@@ -164,12 +338,13 @@ public:
 	 * @param ptrMemFunc pointer to a member function
 	 * @param obj object whose function to call
 	 * @tparam T type of object to associate with slot
+	 * @return connection, which may be used to unregister the slot
 	 *
-	 * @note The object must be derived from \c boost::signals::trackable, which is defined
-	 * 		in <boost/signals/trackable.hpp>. Note that \c FDEvtSource itself derives from it.
+	 * @note The object must be derived from urt::Trackable, which is defined
+	 * 		in Signal.h. Note that \c FDEvtSource itself derives from it.
 	 *
 	 * @code
-	 * class Print : public boost::signals::trackable {
+	 * class Print : public urt::Trackable {
 	 * public:
 	 * 		Print(const std::string& s) : p(s) {}
 	 * 		void print(const std::string& key, const std::string& value) { std::cout<<p<<endl; }
@@ -183,23 +358,82 @@ public:
 	 * @endcode
 	 */
 	template<class T>
-	inline static void registerSlot(const std::string& key, void (T::*ptrMemFunc)(const std::string&, const std::string&), T& obj) {
-		//The reason for casting to boost::signals::trackable and back to T is to enforce
-		//the requirement that T be derived from boost::signals::trackable.
-		//If you get an error here, it is because you are trying to violate that requirement.
-		registerSlot(key, boost::bind(ptrMemFunc, &static_cast<T&>(static_cast<boost::signals::trackable&>(obj)), _1, _2));
+	inline static Connection registerSlot(const std::string& key, void (T::*ptrMemFunc)(const std::string&, const std::string&), T& obj) {
+		return registerSlot(resolve(key), ptrMemFunc, obj);
 	}
 	/**
 	 * Convenience function which enables using a boost::weak_ptr (EvtSourcePtr) instead of a reference.
 	 * @overload
 	 */
 	template<class T>
-	inline static void registerSlot(const std::string& key, void (T::*ptrMemFunc)(const std::string&, const std::string&), boost::weak_ptr<T> ptr) {
-		//This is okay because, provided the object is derived from boost::signals::trackable (as is enforced by
+	inline static Connection registerSlot(const std::string& key, void (T::*ptrMemFunc)(const std::string&, const std::string&), boost::weak_ptr<T> ptr) {
+		//This is okay because, provided the object is derived from Trackable (as is enforced by
 		//the above function), the signal-slot connection will be deleted when the object is deleted. Since the slot
 		//is associated with a reference and not a shared_ptr, registering it will not affect when it is deleted.
 		if(boost::shared_ptr<T> p = ptr.lock())
-			registerSlot(key, ptrMemFunc, *p);
+			return registerSlot(key, ptrMemFunc, *p);
+		return Connection();
+	}
+	/** @overload */
+	template<class T>
+	inline static Connection registerSlot(SubstateHandle h, void (T::*ptrMemFunc)(const std::string&, const std::string&), T& obj) {
+		return substates[h.index].signal.connect(ptrMemFunc, obj);
+	}
+	/** @overload */
+	template<class T>
+	inline static Connection registerSlot(SubstateHandle h, void (T::*ptrMemFunc)(const std::string&, const std::string&), boost::weak_ptr<T> ptr) {
+		if(boost::shared_ptr<T> p = ptr.lock())
+			return registerSlot(h, ptrMemFunc, *p);
+		return Connection();
+	}
+
+	/**
+	 * Registers a slot that is passed the handle of the changed substate rather than its key and value in string form.
+	 * It is called under the same conditions as slots registered with registerSlot(). Use getAs() from within the slot
+	 * to read the value in whatever type is needed; unlike registerSlot(), a numeric substate need never be converted
+	 * to text to notify such slots.
+	 *
+	 * @param h substate to associate slot
+	 * @param slot pointer to non-member function, functor, or static member function taking a SubstateHandle
+	 * @return connection, which may be used to unregister the slot
+	 */
+	static Connection registerValueSlot(SubstateHandle h, const Signal<void (SubstateHandle)>::slot_type& slot) {
+		return substates[h.index].valueSignal.connect(slot);
+	}
+	/**
+	 * Registers class member functions with associated object as a value slot.
+	 * @param h substate to associate slot
+	 * @param ptrMemFunc pointer to a member function
+	 * @param obj object whose function to call; must be derived from urt::Trackable
+	 * @return connection, which may be used to unregister the slot
+	 * @see registerValueSlot(SubstateHandle, const Signal<void (SubstateHandle)>::slot_type&)
+	 */
+	template<class T>
+	inline static Connection registerValueSlot(SubstateHandle h, void (T::*ptrMemFunc)(SubstateHandle), T& obj) {
+		return substates[h.index].valueSignal.connect(ptrMemFunc, obj);
+	}
+
+	/**
+	 * Registers a slot that is called for \b every substate, including ones created later, under the same conditions as
+	 * slots registered with registerValueSlot(). Intended for observers of whole groups of substates, such as
+	 * subscriptions by key prefix; prefer per-substate slots otherwise, since these are called on every change.
+	 *
+	 * @param slot pointer to non-member function, functor, or static member function taking a SubstateHandle
+	 * @return connection, which may be used to unregister the slot
+	 */
+	static Connection registerChangeSlot(const Signal<void (SubstateHandle)>::slot_type& slot) {
+		return changeSignal.connect(slot);
+	}
+	/**
+	 * Registers class member functions with associated object as a change slot.
+	 * @param ptrMemFunc pointer to a member function
+	 * @param obj object whose function to call; must be derived from urt::Trackable
+	 * @return connection, which may be used to unregister the slot
+	 * @see registerChangeSlot(const Signal<void (SubstateHandle)>::slot_type&)
+	 */
+	template<class T>
+	inline static Connection registerChangeSlot(void (T::*ptrMemFunc)(SubstateHandle), T& obj) {
+		return changeSignal.connect(ptrMemFunc, obj);
 	}
 
 private:
@@ -208,20 +442,72 @@ private:
 	 * Holds substate data. Only used within State class and is marked private.
 	 */
 	struct Substate {
-		std::string data;
-		/* All STL containers (like std::map) require their containees to be copyable.
-		 * However, boost::signal<> is not copyable, so we must store a pointer.
-		 * But, Substate will be copied. To work around, we use a shared_ptr and create
-		 * the object in the zero-parameter constructor. We'll use the default copy constructor,
-		 * which will just copy the pointer. When all copies of a Substate are deleted,
-		 * there will be no more shared_ptrs to the signal, and it will be deleted.
+		std::string key;
+		Type type;
+		union {
+			long i;
+			double d;
+			bool b;
+		} number; ///< Value for INT, DOUBLE, and BOOL
+		mutable std::string data; ///< Value for STRING and BLOB; cached string form of other types
+		mutable bool textValid; ///< False if data needs regenerating from number
+		/* Substates are only copied when first inserted into the deque, which never moves them afterwards.
+		 * Copying a Signal yields one with no slots, which is all that is needed.
 		 */
-		boost::shared_ptr<boost::signal<void (const std::string&, const std::string&)> > signal;
+		Signal<void (const std::string&, const std::string&)> signal;
+		Signal<void (SubstateHandle)> valueSignal;
 		bool signalOnTouch;
+		bool pending; ///< True if slots are awaiting the end of a batch
+
+		Substate() : type(STRING), textValid(true), signalOnTouch(false), pending(false) { }
+
+		const std::string& text() const;
+		/** @return true if unset (or set to an empty string) */
+		bool empty() const { return (type == STRING || type == BLOB) && data.empty(); }
+	};
 
-		Substate() : signal(new boost::signal<void (const std::string&, const std::string&)>), signalOnTouch(false) { }
+	/** Converts a Substate to T. By default, through its string form. */
+	template<typename T>
+	struct Converter {
+		static T get(const Substate& s) { return boost::lexical_cast<T>(s.text()); }
 	};
-	static boost::unordered_map<std::string, Substate> substates; ///< Map of all substate data.
+
+	static const Substate& lookup(const std::string& key);
+	static void notify(SubstateHandle h, bool changed);
+	static void fire(SubstateHandle h);
+	static long toLong(const Substate& s);
+	static double toDouble(const Substate& s);
+	static bool toBool(const Substate& s);
+
+	/** All substate data, indexed by SubstateHandle. A deque so that references survive growth. */
+	static std::deque<Substate> substates;
+	static boost::unordered_map<std::string, size_t> indices; ///< Map of keys to positions in substates.
+	static unsigned int batchDepth; ///< Number of nested batches in progress
+	static std::vector<size_t> pending; ///< Substates whose slots will be called when the batch is committed
+	static Signal<void (SubstateHandle)> changeSignal; ///< Fired for every substate after its own slots
+};
+
+//Direct conversions for natively stored types. These give the same results (and throw in the same cases) as
+//converting via the string form would.
+template<> struct State::Converter<std::string> {
+	static std::string get(const Substate& s) { return s.text(); }
+};
+template<> struct State::Converter<long> {
+	static long get(const Substate& s) { return State::toLong(s); }
+};
+template<> struct State::Converter<int> {
+	static int get(const Substate& s) {
+		const long l = State::toLong(s);
+		if(l != static_cast<int>(l))
+			throw boost::bad_lexical_cast(typeid(long), typeid(int));
+		return static_cast<int>(l);
+	}
+};
+template<> struct State::Converter<double> {
+	static double get(const Substate& s) { return State::toDouble(s); }
+};
+template<> struct State::Converter<bool> {
+	static bool get(const Substate& s) { return State::toBool(s); }
 };
 
 }
@@ -25,46 +25,137 @@
 
 #include "StateDevice.h"
 #include "State.h"
+#include "Varint.h"
 #include <string>
+#include <vector>
 
 using namespace urt;
 
+/** @return true if a is earlier than b */
+static inline bool earlier(const timespec& a, const timespec& b) {
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+StateDevice::~StateDevice() {
+	Requests cancelled;
+	cancelled.swap(requests);
+	for(Requests::iterator i = cancelled.begin(); i != cancelled.end(); i++)
+		i->second.promise.fail(Future<std::string>::CANCELLED);
+}
+
 bool StateDevice::onActivity() {
+	if(isHandshaking()) {
+		if(!continueHandshake())
+			return false;
+		if(isHandshaking())
+			return true;
+		//datagrams may have followed the handshake; handle them now, unless the handshake slot refused the device
+	}
+	if(isRejected())
+		return false;
 	try {
-		std::string data;
-		unsigned char type = getDatagram(data);
-		switch(type) {
-			case 0x00: {
-				size_t keySize = data[0];
-				std::string key(1, getAppType());
-				key += getUid();
-				key += data.substr(1, keySize);
-				State::set(key, data.substr(1 + keySize));
-				break;
-			}
-			case 0x01: {
-				std::string key(1, getAppType());
-				key += getUid();
-				key += data.substr(1);
-
-				data += State::get(key);
-				sendDatagram(0x01, data);
-				break;
-			}
-			case 0x02: {
-				std::string key(1, getAppType());
-				key += getUid();
-				key += data.substr(1);
-			  
-				State::registerSlot(key, &StateDevice::sendSubstate, *this);
-				break;
+		fillBuffer();
+		Datagram d;
+		while(nextDatagram(d))
+			if(!handleDatagram(d))
+				return false;
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+bool StateDevice::handleDatagram(const Datagram& d) {
+	if(d.type > 0x05)
+		return false;
+	if(d.size < 1 || ((d.type == 0x00 || d.type == 0x04) && d.size < 1u + static_cast<unsigned char>(d.data[0])))
+		return false;
+	if(d.type == 0x05) { //handled first, as it needs no key
+		const unsigned char id = d.data[0];
+		if(id >= keyIds.size() || !keyIds[id].valid())
+			return false;
+		const std::string value(d.data + 1, d.size - 1);
+		State::set(keyIds[id], value);
+		if(!requests.empty())
+			answer(keyIds[id], value);
+		return true;
+	}
+
+	std::string key(1, getAppType());
+	key += getUid();
+	switch(d.type) {
+		case 0x00: {
+			const size_t keySize = static_cast<unsigned char>(d.data[0]);
+			key.append(d.data + 1, keySize);
+			const std::string value(d.data + 1 + keySize, d.size - 1 - keySize);
+			if(requests.empty()) {
+				State::set(key, value);
+			} else {
+				const SubstateHandle h = State::resolve(key);
+				State::set(h, value);
+				answer(h, value);
 			}
-			default:
+			break;
+		}
+		case 0x01: {
+			key.append(d.data + 1, d.size - 1);
+
+			std::string data(d.data, d.size);
+			data += State::get(key);
+			sendDatagram(0x01, data);
+			break;
+		}
+		case 0x02: {
+			key.append(d.data + 1, d.size - 1);
+
+			State::registerSlot(key, &StateDevice::sendSubstate, *this);
+			break;
+		}
+		case 0x03:
+			return setSubstates(d);
+		case 0x04: {
+			const size_t keySize = static_cast<unsigned char>(d.data[0]);
+			if(d.size != 2 + keySize)
 				return false;
+			key.append(d.data + 1, keySize);
+			if(keyIds.empty())
+				keyIds.resize(0x100);
+			keyIds[static_cast<unsigned char>(d.data[1 + keySize])] = State::resolve(key);
+			break;
 		}
-	} catch (...) {
+	}
+	return true;
+}
+/**
+ * Sets every substate in a batch message, or none if it is malformed.
+ * @param d datagram of type 0x03
+ * @return false if malformed
+ */
+bool StateDevice::setSubstates(const Datagram& d) {
+	//check the whole message first, noting where each key and value lies
+	detail::BatchFields fields;
+	if(!detail::parseBatch(reinterpret_cast<const unsigned char*>(d.data), d.size, fields))
 		return false;
+
+	std::vector<std::pair<SubstateHandle, std::string> > answers; //for requests, answered once the batch is complete
+	{
+		State::Batch batch;
+		std::string key(1, getAppType());
+		key += getUid();
+		for(size_t i = 0; i < fields.size(); i += 2) {
+			key.resize(2);
+			key.append(fields[i].first, fields[i].second);
+			const std::string value(fields[i + 1].first, fields[i + 1].second);
+			if(requests.empty()) {
+				State::set(key, value);
+			} else {
+				const SubstateHandle h = State::resolve(key);
+				State::set(h, value);
+				answers.push_back(std::make_pair(h, value));
+			}
+		}
 	}
+	for(size_t i = 0; i < answers.size(); i++)
+		answer(answers[i].first, answers[i].second);
 	return true;
 }
 void StateDevice::sendSubstate(const std::string& key, const std::string& value, bool removeIDs) {
@@ -88,3 +179,87 @@ try {
 	sendDatagram(0x00, std::string());
 } catch(...) {} //ignore for now; hopefully, it will be picked up in the event loop
 }
+
+/**
+ * Request a substate from the device. Must not be called until the handshake is complete.
+ * @param key key as sent by the device, without its application type and UID
+ * @param timeout milliseconds to wait for the device to report the substate
+ * @return the value reported; a cancelled Future if still handshaking
+ */
+Future<std::string> StateDevice::request(const std::string& key, unsigned int timeout) {
+	if(isHandshaking())
+		return Future<std::string>();
+	std::string fullKey(1, getAppType());
+	fullKey += getUid();
+	fullKey += key;
+
+	Request r;
+	clock_gettime(CLOCK_MONOTONIC, &r.deadline);
+	r.deadline.tv_sec += timeout / 1000;
+	r.deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if(r.deadline.tv_nsec >= 1000000000L) {
+		r.deadline.tv_sec++;
+		r.deadline.tv_nsec -= 1000000000L;
+	}
+	const bool polled = !requests.empty(); //a poll is already on its way
+	requests.insert(std::make_pair(State::resolve(fullKey), r));
+	scheduleTimeout();
+	if(!polled)
+		poll();
+	return r.promise.getFuture();
+}
+
+/**
+ * Resolve every request for a substate the device has just reported.
+ */
+void StateDevice::answer(const SubstateHandle& h, const std::string& value) {
+	const std::pair<Requests::iterator, Requests::iterator> range = requests.equal_range(h);
+	if(range.first == range.second)
+		return;
+	std::vector<Promise<std::string> > answered;
+	for(Requests::iterator i = range.first; i != range.second; i++)
+		answered.push_back(i->second.promise);
+	requests.erase(range.first, range.second); //before resolving, so continuations may make new requests
+	scheduleTimeout();
+	for(size_t i = 0; i < answered.size(); i++)
+		answered[i].resolve(value);
+}
+
+/**
+ * Schedule a wakeup for the earliest request to time out.
+ */
+void StateDevice::scheduleTimeout() {
+	if(requests.empty()) {
+		cancelWakeup();
+		return;
+	}
+	Requests::const_iterator first = requests.begin();
+	for(Requests::const_iterator i = requests.begin(); i != requests.end(); i++)
+		if(earlier(i->second.deadline, first->second.deadline))
+			first = i;
+	scheduleWakeup(first->second.deadline);
+}
+
+/**
+ * Fail every request whose timeout has passed.
+ */
+bool StateDevice::onWakeup() {
+	if(isHandshaking())
+		return ArdPort::onWakeup();
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	std::vector<Promise<std::string> > expired;
+	for(Requests::iterator i = requests.begin(); i != requests.end();) {
+		if(!earlier(now, i->second.deadline)) {
+			expired.push_back(i->second.promise);
+			requests.erase(i++);
+		} else {
+			i++;
+		}
+	}
+	scheduleTimeout();
+	for(size_t i = 0; i < expired.size(); i++)
+		expired[i].fail(Future<std::string>::TIMED_OUT);
+	return true;
+}
@@ -27,6 +27,11 @@
 #define STATEDEVICE_H_
 
 #include "ArdPort.h"
+#include "Future.h"
+#include "State.h"
+#include <ctime>
+#include <map>
+#include <vector>
 
 namespace urt {
 
@@ -36,8 +41,8 @@ namespace urt {
  * data, it is always in key-value pair form. The server simply has to then commit that
  * pair to the State. Since this process is the same for any kind of sensor device,
  * only one type of class, StateDevice, is needed. There is no need to extend this class
- * for a particular device provided it uses the StateDevice protocol. (Unlike its ancestors
- * StateDevice is, in fact, a concrete class and contains no virtual functions or destructor.)
+ * for a particular device provided it uses the StateDevice protocol. (Unlike its ancestors,
+ * StateDevice is, in fact, a concrete class.)
  *
  * @note The key used by State is not the same as the key sent by the device. Instead,
  * 	the application type and UID is prepended to the sent state. This opens up a wide
@@ -51,6 +56,11 @@ namespace urt {
  * In general, this function would be connected as a slot to the event loop's interval signal,
  * essentially regularly polling the devices each timeout period.
  *
+ * Code that needs a particular substate as soon as possible can instead request() it. The device is polled
+ * (unless requests are already outstanding, in which case a poll is already on its way), and the returned Future
+ * is resolved when the device next reports the substate, however it does so, or fails once the timeout passes.
+ * Requests are matched by key, so any number may be outstanding at once.
+ *
  * The protocol also permits the device to register a substate for push notification. The server will
  * automatically notify the device if the substate changes as if the device requested its status.
  * The device should register all desired substates immediately after handshaking with the server
@@ -64,8 +74,22 @@ namespace urt {
  * <tr>	<td>0x00</td>		<td>(key length: 1 byte)(key)(value)</td>	<td>device is setting state</td></tr>
  * <tr>	<td>0x01</td>		<td>(key length: 1 byte)(key)</td>		<td>device is requesting state</td></tr>
  * <tr>	<td>0x02</td>		<td>(key length: 1 byte)(key)</td>		<td>device is registering substate for push notification</td></tr>
+ * <tr>	<td>0x03</td>		<td>{(key length: 1 byte)(key)(value length: varint)(value)} repeated</td>	<td>device is setting several states at once</td></tr>
+ * <tr>	<td>0x04</td>		<td>(key length: 1 byte)(key)(ID: 1 byte)</td>	<td>device is assigning an ID to a key</td></tr>
+ * <tr>	<td>0x05</td>		<td>(ID: 1 byte)(value)</td>			<td>device is setting state by ID</td></tr>
  * </table>
  *
+ * A message of type 0x03 is applied atomically: the substates are all set within one State batch (see State::Batch),
+ * so slots observe them together, and if any part of the message is malformed, none are set. The value length is
+ * encoded seven bits per byte, least significant first, with the high bit set on every byte but the last (a single
+ * byte for values shorter than 128 bytes).
+ *
+ * To save bytes on slow links, a device may assign any of its keys a one-byte ID with a message of type 0x04 and
+ * thereafter set the substate with messages of type 0x05, which carry only the ID and value. The server resolves the
+ * key once, when the ID is assigned, so setting by ID involves no key handling at all. Like registrations, IDs last
+ * only for the session; the device should assign them after handshaking. Reassigning an ID replaces the previous
+ * assignment. A message of type 0x05 with an unassigned ID is an error.
+ *
  * The different message options for server to device communication are as follows:
  * <table>
  * <tr>	<td>\b Type</td>	<td>\b Message \b Contents</td>	<td>\b Comment</td></tr>
@@ -78,8 +102,11 @@ public:
 	/**
 	 * Constructs StateDevice.
 	 * @param dev path to serial port device file
+	 * @param async if true, handshake once added to an EventLoop rather than in the constructor (see ArdPort)
 	 */
-	StateDevice(const char* dev) : ArdPort(dev) {}
+	StateDevice(const char* dev, bool async = false) : ArdPort(dev, async) {}
+	/** Cancels any outstanding requests. */
+	~StateDevice();
 
 	/**
 	 * Transmits message type 0x00 with no payload to to indicate that
@@ -87,6 +114,7 @@ public:
 	 * @throw SerialException thrown on error
 	 */
 	void poll() throw (SerialException);
+	Future<std::string> request(const std::string& key, unsigned int timeout = REQUEST_TIMEOUT);
 
 	/**
 	 * Sends a Substate to associated device consisting of key, value pair.
@@ -113,12 +141,35 @@ public:
 	 */
 	void sendSubstate(const std::string& key, bool removeIDs = true);
 
+	static const unsigned int REQUEST_TIMEOUT = 1000; ///< Default timeout of request(), in milliseconds
+
 private:
+	/** An outstanding request(). */
+	struct Request {
+		Promise<std::string> promise;
+		timespec deadline; ///< When the request times out (CLOCK_MONOTONIC)
+	};
+	typedef std::multimap<SubstateHandle, Request> Requests;
+
 	//prevent inadvertent use of lower-level I/O calls
-	using ArdPort::getDatagram;
+	using ArdPort::fillBuffer;
+	using ArdPort::nextDatagram;
 	using ArdPort::sendDatagram;
 	
 	bool onActivity();
+	bool onWakeup();
+	/**
+	 * Acts on a single received datagram.
+	 * @param d datagram
+	 * @return false if the datagram was not understood
+	 */
+	bool handleDatagram(const Datagram& d);
+	bool setSubstates(const Datagram& d);
+	void answer(const SubstateHandle& h, const std::string& value);
+	void scheduleTimeout();
+
+	std::vector<SubstateHandle> keyIds; ///< Substates by ID assigned by the device; empty until the first assignment
+	Requests requests; ///< Outstanding requests by substate
 };
 
 }
@@ -25,41 +25,394 @@
 
 #include "StateSocket.h"
 #include "State.h"
+#include "Log.h"
+#include <sys/socket.h> //for shutdown
+#include <cstring> //for std::memcpy
+#include <ctime>
+#include "Varint.h"
+#include "RxBuffer.h"
 
 namespace urt {
 
-unsigned char StateSocket::msg[256];
+/** @return \c t advanced by \c millis milliseconds */
+static timespec addMillis(timespec t, unsigned int millis)
+{
+	t.tv_sec += millis / 1000;
+	t.tv_nsec += (millis % 1000) * 1000000L;
+	if(t.tv_nsec >= 1000000000L) {
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000L;
+	}
+	return t;
+}
+
+/** @return true if \c a is strictly before \c b */
+static inline bool earlier(const timespec& a, const timespec& b)
+{
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
 
 void StateSocket::sendSubstate(const std::string& key, const std::string& value) throw (SocketException) {
-	std::string returnMsg(1, key.size() + value.size() + 2);
-	returnMsg += 0x01;
-	returnMsg += static_cast<unsigned char>(key.size());
-	returnMsg += key;
-	returnMsg += value;
-	send(returnMsg.c_str(), returnMsg.size());
+	if(stalled)
+		throw SocketException("Client not keeping up; disconnected");
+	const size_t size = key.size() + value.size() + 2;
+	unsigned char header[1 + detail::VARINT_MAX_BYTES + 2];
+	size_t headerSize;
+	if(size <= 0xFF) {
+		header[0] = size;
+		headerSize = 1;
+	} else if(extendedFraming && size <= MAX_EXTENDED_MESSAGE) {
+		header[0] = 0x00;
+		headerSize = 1 + detail::encodeVarint(size, header + 1);
+	} else {
+		throw SocketException("Substate too large to send");
+	}
+	header[headerSize++] = 0x01;
+	header[headerSize++] = key.size();
+	iovec iov[3] = {
+		{header, headerSize},
+		{const_cast<char*>(key.data()), key.size()},
+		{const_cast<char*>(value.data()), value.size()}
+	};
+	send(iov, 3);
+}
+
+/**
+ * Send a substate by the ID the remote host assigned it.
+ * @param id ID
+ * @param value substate value
+ * @throws SocketException thrown on error
+ */
+void StateSocket::sendById(size_t id, const std::string& value) throw (SocketException) {
+	if(stalled)
+		throw SocketException("Client not keeping up; disconnected");
+	unsigned char idBytes[detail::VARINT_MAX_BYTES];
+	const size_t idSize = detail::encodeVarint(id, idBytes);
+	const size_t size = 1 + idSize + value.size();
+	unsigned char header[1 + detail::VARINT_MAX_BYTES + 1 + detail::VARINT_MAX_BYTES];
+	size_t headerSize;
+	if(size <= 0xFF) {
+		header[0] = size;
+		headerSize = 1;
+	} else if(extendedFraming && size <= MAX_EXTENDED_MESSAGE) {
+		header[0] = 0x00;
+		headerSize = 1 + detail::encodeVarint(size, header + 1);
+	} else {
+		throw SocketException("Substate too large to send");
+	}
+	header[headerSize++] = 0x08;
+	std::memcpy(header + headerSize, idBytes, idSize);
+	headerSize += idSize;
+	iovec iov[2] = {
+		{header, headerSize},
+		{const_cast<char*>(value.data()), value.size()}
+	};
+	send(iov, 2);
 }
 
 bool StateSocket::onActivity() {
+	if(stalled)
+		return false;
 	try {
-		unsigned char msgSize;
-		get(&msgSize, sizeof(msgSize));
+		const size_t space = detail::prepareRxBuffer(rxBuffer, rxStart, rxEnd);
+		rxEnd += getAvailable(&rxBuffer[rxEnd], space);
 
-		get(msg, msgSize);
-
-		switch(msg[0]) {//message type
-			case 0x00: {
-				//key size = msg[1], key = msg[2], value = msg[msg[1] + 2]
-				State::set(std::string(reinterpret_cast<char*>(&msg[2]), msg[1]), std::string(reinterpret_cast<char*>(&msg[msg[1] + 2]), msgSize - msg[1] - 2));
-				break;
-			}
-			case 0x01: {
-				std::string key(reinterpret_cast<char*>(&msg[2]), msgSize - 2);
-				sendSubstate(key, State::get(key));
-				break;
+		//handle every complete message: {size}{message: size bytes} or 0x00 {size: varint}{message: size bytes}
+		while(rxStart < rxEnd) {
+			const unsigned char* frame = &rxBuffer[rxStart];
+			const size_t available = rxEnd - rxStart;
+			size_t msgSize;
+			size_t headerSize = 1;
+			if(frame[0] == 0x00) {
+				const int lengthSize = detail::decodeVarint(frame + 1, available - 1, msgSize);
+				if(lengthSize == 0)
+					break; //incomplete
+				if(lengthSize < 0 || msgSize > MAX_EXTENDED_MESSAGE)
+					return false;
+				headerSize += lengthSize;
+			} else {
+				msgSize = frame[0];
 			}
+			if(available < headerSize + msgSize)
+				break; //incomplete
+			rxStart += headerSize + msgSize;
+			handleMessage(frame + headerSize, msgSize);
 		}
 		return IsOk();
 	} catch (...) { return false; }
 }
 
+/**
+ * Acts on a single complete message. Malformed messages are ignored.
+ * @param msg message, beginning with its type
+ * @param msgSize length of message
+ */
+void StateSocket::handleMessage(const unsigned char* msg, size_t msgSize) {
+	if(msgSize < 2)
+		return;
+	if(msg[0] == 0xFE) { //framing negotiation
+		extendedFraming = (msg[1] >= 1);
+		const unsigned char reply[3] = {2, 0xFE, FRAMING_VERSION};
+		send(reply, sizeof(reply));
+		return;
+	}
+	if(msg[0] == 0x08) { //handled first, as it carries no key
+		size_t id;
+		const int idSize = detail::decodeVarint(msg + 1, msgSize - 1, id);
+		if(idSize > 0 && id < keyIds.size() && keyIds[id].valid())
+			State::set(keyIds[id], std::string(reinterpret_cast<const char*>(msg + 1 + idSize), msgSize - 1 - idSize));
+		return;
+	}
+	//all other messages but 0x01 carry a key size; check it fits
+	if(msg[0] != 0x01 && msg[1] > msgSize - 2)
+		return;
+	switch(msg[0]) {//message type
+		case 0x00: {
+			//key size = msg[1], key = msg[2], value = msg[msg[1] + 2]
+			State::set(std::string(reinterpret_cast<const char*>(&msg[2]), msg[1]), std::string(reinterpret_cast<const char*>(&msg[msg[1] + 2]), msgSize - msg[1] - 2));
+			break;
+		}
+		case 0x01: {
+			std::string key(reinterpret_cast<const char*>(&msg[2]), msgSize - 2);
+			const std::string value = State::get(key);
+			if(extendedFraming || key.size() + value.size() + 2 <= 0xFF)
+				sendSubstate(key, value); //otherwise, the value cannot be sent to this client
+			break;
+		}
+		case 0x02:
+		case 0x04: {
+			std::string key(reinterpret_cast<const char*>(&msg[2]), msg[1]);
+			unsigned int interval = 0;
+			if(msgSize - msg[1] - 2 == 2)
+				interval = (msg[msg[1] + 2] << 8) | msg[msg[1] + 3];
+			subscribe(key, msg[0] == 0x04, interval);
+			break;
+		}
+		case 0x03:
+		case 0x05:
+			unsubscribe(std::string(reinterpret_cast<const char*>(&msg[2]), msg[1]), msg[0] == 0x05);
+			break;
+		case 0x06:
+			setSubstates(msg + 1, msgSize - 1);
+			break;
+		case 0x07:
+			assignId(std::string(reinterpret_cast<const char*>(&msg[2]), msg[1]), msg + 2 + msg[1], msgSize - 2 - msg[1]);
+			break;
+	}
+}
+
+/**
+ * Sets every substate in a batch message, or none if it is malformed.
+ * @param msg message following its type
+ * @param msgSize length of message
+ */
+void StateSocket::setSubstates(const unsigned char* msg, size_t msgSize) {
+	//check the whole message first, noting where each key and value lies
+	detail::BatchFields fields;
+	if(!detail::parseBatch(msg, msgSize, fields))
+		return;
+
+	State::Batch batch;
+	for(size_t i = 0; i < fields.size(); i += 2)
+		State::set(std::string(fields[i].first, fields[i].second), std::string(fields[i + 1].first, fields[i + 1].second));
+}
+
+/**
+ * Assign a key an ID, replacing any previous assignment of either.
+ * @param key substate key
+ * @param id encoded ID
+ * @param idSize length of encoded ID
+ */
+void StateSocket::assignId(const std::string& key, const unsigned char* id, size_t idSize) {
+	size_t value;
+	if(idSize == 0 || detail::decodeVarint(id, idSize, value) != static_cast<int>(idSize) || value >= MAX_KEY_IDS)
+		return;
+	const SubstateHandle h = State::resolve(key);
+
+	if(value < keyIds.size() && keyIds[value].valid())
+		idOf.erase(keyIds[value]); //ID reassigned
+	std::map<SubstateHandle, size_t>::iterator old = idOf.find(h);
+	if(old != idOf.end())
+		keyIds[old->second] = SubstateHandle(); //key reassigned
+
+	if(value >= keyIds.size())
+		keyIds.resize(value + 1);
+	keyIds[value] = h;
+	idOf[h] = value;
+}
+
+/**
+ * Subscribe the remote host to a substate or key prefix, replacing any previous subscription to the same.
+ * @param key key or key prefix
+ * @param prefix true if \c key is a prefix
+ * @param interval minimum milliseconds between pushes of any one substate
+ */
+void StateSocket::subscribe(const std::string& key, bool prefix, unsigned int interval) {
+	if(prefix) {
+		if(prefixSubscriptions.empty())
+			changeConnection = State::registerChangeSlot(&StateSocket::onAnyChange, *this);
+		prefixSubscriptions[key] = interval;
+	} else {
+		KeySubscription& sub = keySubscriptions[key];
+		sub.interval = interval;
+		if(!sub.connection.connected())
+			sub.connection = State::registerValueSlot(State::resolve(key), &StateSocket::onKeyChange, *this);
+	}
+}
+
+/**
+ * Remove a subscription. Does nothing if the remote host is not subscribed.
+ * @param key key or key prefix
+ * @param prefix true if \c key is a prefix
+ */
+void StateSocket::unsubscribe(const std::string& key, bool prefix) {
+	if(prefix) {
+		if(prefixSubscriptions.erase(key) && prefixSubscriptions.empty())
+			changeConnection.disconnect();
+	} else {
+		std::map<std::string, KeySubscription>::iterator i = keySubscriptions.find(key);
+		if(i != keySubscriptions.end()) {
+			i->second.connection.disconnect();
+			keySubscriptions.erase(i);
+		}
+	}
+}
+
+/**
+ * Find the subscription covering a substate: its key subscription if any, otherwise the matching prefix subscription
+ * with the shortest interval.
+ * @param h substate
+ * @param interval set to the subscription's interval
+ * @return false if the remote host is not subscribed to the substate
+ */
+bool StateSocket::findSubscription(SubstateHandle h, unsigned int& interval) const {
+	const std::string& key = State::getKey(h);
+	std::map<std::string, KeySubscription>::const_iterator k = keySubscriptions.find(key);
+	if(k != keySubscriptions.end()) {
+		interval = k->second.interval;
+		return true;
+	}
+
+	bool matched = false;
+	for(std::map<std::string, unsigned int>::const_iterator i = prefixSubscriptions.begin(); i != prefixSubscriptions.end(); i++) {
+		if(key.compare(0, i->first.size(), i->first) == 0 && (!matched || i->second < interval)) {
+			matched = true;
+			interval = i->second;
+		}
+	}
+	return matched;
+}
+
+/**
+ * Slot for substates subscribed to by key.
+ */
+void StateSocket::onKeyChange(SubstateHandle h) {
+	unsigned int interval;
+	if(findSubscription(h, interval))
+		push(h, interval);
+}
+
+/**
+ * Slot for every substate while prefix subscriptions exist.
+ */
+void StateSocket::onAnyChange(SubstateHandle h) {
+	if(keySubscriptions.count(State::getKey(h)))
+		return; //handled by onKeyChange()
+	unsigned int interval;
+	if(findSubscription(h, interval))
+		push(h, interval);
+}
+
+/**
+ * Push a changed substate now, or later if it was pushed less than \c interval milliseconds ago.
+ * @param h substate changed
+ * @param interval minimum milliseconds between pushes
+ */
+void StateSocket::push(SubstateHandle h, unsigned int interval) {
+	if(interval == 0) {
+		pushNow(h);
+		return;
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	std::map<SubstateHandle, Throttle>::iterator i = throttles.find(h);
+	if(i == throttles.end()) {
+		Throttle t = {now, interval, false};
+		throttles.insert(std::make_pair(h, t));
+		pushNow(h);
+		return;
+	}
+
+	Throttle& t = i->second;
+	t.interval = interval;
+	if(t.pending)
+		return; //the latest value is sent when the wakeup arrives
+	const timespec due = addMillis(t.lastSent, interval);
+	if(!earlier(now, due)) {
+		t.lastSent = now;
+		pushNow(h);
+	} else {
+		t.pending = true;
+		if(!wakeupScheduled || earlier(due, nextWakeup)) {
+			wakeupScheduled = true;
+			nextWakeup = due;
+			scheduleWakeup(due);
+		}
+	}
+}
+
+/**
+ * Send a substate's current value. Errors are left for onActivity() to discover, since this is called from State slots.
+ */
+void StateSocket::pushNow(SubstateHandle h) {
+	try {
+		std::map<SubstateHandle, size_t>::const_iterator i = idOf.find(h);
+		if(i != idOf.end())
+			sendById(i->second, State::get(h));
+		else
+			sendSubstate(State::getKey(h), State::get(h));
+	} catch(...) {}
+}
+
+/**
+ * Drop a client that has stopped reading. The connection is shut down rather than closed so that the descriptor stays
+ * valid until the EventLoop removes the socket, which it does once onActivity() sees the shutdown.
+ */
+void StateSocket::onHighWater() {
+	Log::warning("StateSocket client is not keeping up; disconnecting it");
+	stalled = true;
+	::shutdown(fdesc, SHUT_RDWR);
+}
+
+/**
+ * Push every held-back substate whose interval has passed.
+ */
+bool StateSocket::onWakeup() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wakeupScheduled = false;
+	for(std::map<SubstateHandle, Throttle>::iterator i = throttles.begin(); i != throttles.end(); i++) {
+		Throttle& t = i->second;
+		if(!t.pending)
+			continue;
+		if(!findSubscription(i->first, t.interval)) {
+			t.pending = false; //unsubscribed since
+			continue;
+		}
+		const timespec due = addMillis(t.lastSent, t.interval);
+		if(!earlier(now, due)) {
+			t.pending = false;
+			t.lastSent = now;
+			pushNow(i->first);
+		} else if(!wakeupScheduled || earlier(due, nextWakeup)) {
+			wakeupScheduled = true;
+			nextWakeup = due;
+		}
+	}
+	if(wakeupScheduled)
+		scheduleWakeup(nextWakeup);
+	return true;
+}
+
 }
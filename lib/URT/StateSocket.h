@@ -27,6 +27,10 @@
 #define STATESOCKET_H_
 
 #include "Socket.h"
+#include "State.h"
+#include <map>
+#include <vector>
+#include <string>
 
 namespace urt {
 
@@ -47,9 +51,50 @@ namespace urt {
  * <tt>{size: 1 byte}{message_type: 1 byte}{key_size: 1 byte}{key: key_size bytes}{value: size-key_size-2 bytes}</tt><br>
  * If a value is not applicable (for example, when getting a value), the value should be omitted.
  *
+ * <b>Extended framing.</b> Messages longer than 255 bytes are sent as <tt>0x00 {size: varint}{message: size bytes}</tt>,
+ * where the message is everything that follows the size byte in the format above, and the size is encoded seven bits
+ * per byte, least significant first, with the high bit set on every byte but the last. A legacy message never has a
+ * size of zero, so the server accepts either format at any time. To receive extended messages, the remote host must
+ * first send <tt>0x02 0xFE {version}</tt> with the highest framing version it supports (currently 1); the server
+ * replies in kind with its own. Until then, substates whose values do not fit in a legacy message are not sent.
+ *
+ * Incoming bytes are read without blocking and reassembled in a per-connection buffer, so a message may arrive
+ * over any number of reads and a single read may carry any number of messages.
+ * Outgoing messages are queued (see FDEvtSource::queueWrite), so a slow client never blocks the EventLoop. A client
+ * that stops reading altogether would make the queue grow without bound, so once more than HIGH_WATER_MARK bytes are
+ * waiting (or whatever setHighWaterMark() was given since), the client is considered stalled: a warning is logged,
+ * further sends throw SocketException instead of queuing, and the connection is shut down, so the socket is removed from its EventLoop on its next
+ * activity. A client that wants every change must therefore keep up, or subscribe with a minimum interval.
+ *
  * The following message types are defined:
  * 	\li \c 0x00 remote host is setting a substate
  * 	\li \c 0x01 remote host is getting a substate; server responds with full packet as described above with type \c 0x01
+ * 	\li \c 0x02 remote host is subscribing to a substate; the value, if present, is the minimum interval between updates
+ * 		in milliseconds (2 bytes, most significant first)
+ * 	\li \c 0x03 remote host is unsubscribing from a substate; no value
+ * 	\li \c 0x04 remote host is subscribing to all substates whose keys begin with the given key (an empty key matches
+ * 		every substate); the value is as for \c 0x02
+ * 	\li \c 0x05 remote host is unsubscribing from a key prefix; no value
+ * 	\li \c 0x06 remote host is setting several substates at once; in place of the key size, key, and value, the message
+ * 		holds <tt>{key_size: 1 byte}{key}{value_size: varint}{value}</tt> for each substate
+ * 	\li \c 0x07 remote host is assigning an ID to a key; the value is the ID (varint)
+ * 	\li \c 0x08 remote host is setting a substate by ID; in place of the key size and key, the message holds
+ * 		<tt>{id: varint}</tt>
+ *
+ * A message of type \c 0x06 is applied atomically: the substates are all set within one State batch (see State::Batch),
+ * so slots observe them together, and if any part of the message is malformed, none are set. The value size is encoded
+ * like the extended message size above (a single byte for values shorter than 128 bytes).
+ *
+ * IDs let a remote host that sets or receives the same substates repeatedly send each key only once per connection.
+ * The server resolves the key when the ID is assigned, so messages of type \c 0x08 involve no key handling at all.
+ * Reassigning an ID, or assigning a key a second ID, replaces the previous assignment. IDs must be less than
+ * MAX_KEY_IDS; messages with other IDs, or IDs not yet assigned, are ignored.
+ *
+ * Whenever a subscribed substate changes, the server pushes it to the remote host as a \c 0x01 message, exactly as if it
+ * had been requested, or, if the remote host has assigned the substate an ID, as a \c 0x08 message. If a minimum interval was given, changes arriving sooner than that after the previous push are
+ * held back, and only the latest value is pushed once the interval has passed. Subscribing to a key or prefix again
+ * replaces the previous interval rather than adding a second subscription. Substates matched by both a key and a prefix
+ * subscription are pushed according to the key subscription.
  */
 class StateSocket: public Socket {
 public:
@@ -59,13 +104,21 @@ public:
 	 * @param port port number to which to connect
 	 * @throws SocketException thrown when unable to connect to server
 	 */
-	StateSocket(const char* ipAddress, unsigned short port) throw (SocketException) : Socket(ipAddress, port) {}
+	StateSocket(const char* ipAddress, unsigned short port) throw (SocketException) : Socket(ipAddress, port),
+		extendedFraming(false), rxBuffer(RX_BUFFER_SIZE), rxStart(0), rxEnd(0), wakeupScheduled(false), stalled(false) {
+		queuedWrites = true;
+		setHighWaterMark(HIGH_WATER_MARK);
+	}
 	/**
 	 * Creates a StateSocket object for an already opened socket given its file descriptor.
 	 *
 	 * @note The StateSocket takes ownership of the socket and will close it when necessary.
 	 */
-	StateSocket(int fd) : Socket(fd) {}
+	StateSocket(int fd) : Socket(fd),
+		extendedFraming(false), rxBuffer(RX_BUFFER_SIZE), rxStart(0), rxEnd(0), wakeupScheduled(false), stalled(false) {
+		queuedWrites = true;
+		setHighWaterMark(HIGH_WATER_MARK);
+	}
 	virtual ~StateSocket() {}
 
 	/**
@@ -75,15 +128,68 @@ public:
 	 * @throws SocketException thrown on error
 	 */
 	void sendSubstate(const std::string& key, const std::string& value) throw (SocketException);
+	/**
+	 * Determine whether the remote host has asked for extended framing.
+	 * @return true if messages longer than 255 bytes may be sent
+	 */
+	bool hasExtendedFraming() const { return extendedFraming; }
+	using Socket::setHighWaterMark;
+
+	static const unsigned char FRAMING_VERSION = 1; ///< Highest framing version supported
+	static const size_t MAX_EXTENDED_MESSAGE = 1 << 20; ///< Largest message accepted or sent in extended framing
+	static const size_t MAX_KEY_IDS = 4096; ///< Bound on key IDs, which index a table
+	static const size_t HIGH_WATER_MARK = 256 * 1024; ///< Default bound on queued output before a client is dropped
 
 private:
-	static unsigned char msg[256];
+	/** Pushing state of one subscribed substate, for rate limiting. */
+	struct Throttle {
+		timespec lastSent; ///< Time of last push (CLOCK_MONOTONIC)
+		unsigned int interval; ///< Minimum milliseconds between pushes
+		bool pending; ///< True if a change is being held back
+	};
+	/** Subscription to a single key. */
+	struct KeySubscription {
+		unsigned int interval; ///< Minimum milliseconds between pushes
+		Connection connection; ///< Connection to the substate's value signal
+	};
+
+	static const size_t RX_BUFFER_SIZE = 512; ///< Initial buffer size; room for one legacy message plus a partial one
 
 	//prevent inadvertent use of lower-level get and send calls
 	using Socket::get;
+	using Socket::getAvailable;
 	using Socket::send;
 	
 	bool onActivity();
+	bool onWakeup();
+	void onHighWater();
+	void handleMessage(const unsigned char* msg, size_t msgSize);
+	void setSubstates(const unsigned char* msg, size_t msgSize);
+	void assignId(const std::string& key, const unsigned char* id, size_t idSize);
+	void sendById(size_t id, const std::string& value) throw (SocketException);
+	void subscribe(const std::string& key, bool prefix, unsigned int interval);
+	void unsubscribe(const std::string& key, bool prefix);
+	bool findSubscription(SubstateHandle h, unsigned int& interval) const;
+	void onKeyChange(SubstateHandle h);
+	void onAnyChange(SubstateHandle h);
+	void push(SubstateHandle h, unsigned int interval);
+	void pushNow(SubstateHandle h);
+
+	bool extendedFraming; ///< True once the remote host has asked for extended framing
+	std::vector<unsigned char> rxBuffer; ///< Received bytes not yet consumed lie in [rxStart, rxEnd); grows for extended messages
+	size_t rxStart; ///< Start of first unconsumed byte
+	size_t rxEnd; ///< End of received bytes
+
+	std::vector<SubstateHandle> keyIds; ///< Substates by ID assigned by the remote host
+	std::map<SubstateHandle, size_t> idOf; ///< Inverse of keyIds, for pushing by ID
+
+	std::map<std::string, KeySubscription> keySubscriptions; ///< Subscriptions by exact key
+	std::map<std::string, unsigned int> prefixSubscriptions; ///< Subscriptions by key prefix, with their intervals
+	Connection changeConnection; ///< Connection to State's change signal; connected while prefix subscriptions exist
+	std::map<SubstateHandle, Throttle> throttles; ///< Rate-limited substates pushed at least once
+	timespec nextWakeup; ///< Time of earliest held-back push
+	bool wakeupScheduled; ///< True if a wakeup is scheduled for nextWakeup
+	bool stalled; ///< True once the output queue passed the high-water mark; the connection is being dropped
 };
 
 }
@@ -17,87 +17,97 @@
  */
 
 #include "Timer.h"
+#include <sys/timerfd.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <fcntl.h>
+#include <stdint.h>
 
 using namespace urt;
 
-void Timer::timerThread(sigval_t obj) {
-	const Timer* const ptr = reinterpret_cast<Timer*>(obj.sival_ptr);
-	write(ptr->writePipe, "", 1); //send null terminator
+static inline long long toNanos(const timespec& t) {
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
 }
-Timer::Timer(unsigned int millis, bool start) throw (TimerException) {
-	//create inter-thread communication pipe
-	int pipefd[2];
-	if(pipe(pipefd) != 0 || fcntl(pipefd[0], F_SETFL, O_NONBLOCK) == -1)
-		throw TimerException("Error creating timer pipe.");
-	fdesc = pipefd[0];
-	writePipe = pipefd[1];
-	
-	//initalize sigevent to control the timer event (i.e., make it call timerThread in another thread)
-	struct sigevent evp;
-	evp.sigev_notify = SIGEV_THREAD;
-	evp.sigev_signo = 0;
-	evp.sigev_value.sival_ptr = this;
-	evp.sigev_notify_function = &Timer::timerThread;
-	
-	//specific attributes of new timer thread
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-		//we don't need to join; non-joinable (detached) save resources
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-		//the thread basically needs only a few bytes of stack memory (for the parameter, stack ptr., etc.)
-		//16384 is PTHREAD_STACK_MIN
-	pthread_attr_setstacksize(&attr, 16384);
-	evp.sigev_notify_attributes = &attr;
-	
-	//create the timer
-	if(timer_create(CLOCK_MONOTONIC, &evp, &m_timerid) == -1) {
-		close(fdesc);
-		close(writePipe);
-		pthread_attr_destroy(&attr);
-		throw TimerException("Error creating real-time timer primative.");
+static inline timespec fromNanos(long long n) {
+	timespec t;
+	t.tv_sec = n / 1000000000LL;
+	t.tv_nsec = n % 1000000000LL;
+	return t;
+}
+
+Timer::Timer(unsigned int millis, bool start, Backend backend) throw (TimerException) : m_backend(backend), m_expirations(0) {
+	m_interval.tv_sec = millis / 1000;
+	m_interval.tv_nsec = (millis % 1000) * 1000000L;
+
+	if(backend == TIMERFD) {
+		fdesc = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if(fdesc == -1)
+			throw TimerException("Error creating timerfd.");
+	} else {
+		//no file descriptor; the EventLoop drives us purely through wakeups
+		fdesc = -1;
 	}
-		
-	//set the timer interval
-	m_its.it_interval.tv_sec = millis / 1000;
-	m_its.it_interval.tv_nsec = (millis % 1000) * 1000000;
+
 	try {
 		if(start) Timer::start();
-		else stop();
 	} catch(...) {
-		close(fdesc);
-		close(writePipe);
-		pthread_attr_destroy(&attr);
-		timer_delete(&m_timerid);
+		if(fdesc != -1)
+			close(fdesc);
 		throw;
 	}
-
-	//release attribute resources
-	pthread_attr_destroy(&attr);
 }
 Timer::~Timer() {
-	timer_delete(m_timerid);
-	close(fdesc);
-	close(writePipe);
+	if(fdesc != -1)
+		close(fdesc);
 }
 bool Timer::onActivity() {
-	//We use 2 so that if there is only 1 (as should be the case during normal operations),
-	//we'll know with just one read call.
-	char dummy[2];
-	while(read(fdesc, &dummy, sizeof(dummy)) > 1); //empty buffer
+	//only watched for I/O with the TIMERFD backend
+	uint64_t count;
+	if(read(fdesc, &count, sizeof(count)) != sizeof(count))
+		return true; //spurious (EAGAIN) or timer was re-armed since it became readable
+	m_expirations = count;
+	return onTimeout();
+}
+bool Timer::onWakeup() {
+	//Schedule from the missed deadline, not from now, so servicing delays don't accumulate.
+	//If whole intervals were missed, skip them instead of firing repeatedly.
+	const long long interval = toNanos(m_interval);
+	long long next = toNanos(m_deadline) + interval;
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const long long current = toNanos(now);
+	m_expirations = 1;
+	if(next <= current) {
+		const long long missed = (current - next) / interval + 1;
+		next += missed * interval;
+		m_expirations += missed;
+	}
+	m_deadline = fromNanos(next);
+	scheduleWakeup(m_deadline);
 	return onTimeout();
 }
 void Timer::start() {
-	m_its.it_value.tv_sec = m_its.it_interval.tv_sec;
-	m_its.it_value.tv_nsec = m_its.it_interval.tv_nsec;
-	if(timer_settime(m_timerid, 0, &m_its, NULL) == -1)
-		throw TimerException("Error starting timer.");
+	if(m_backend == TIMERFD) {
+		itimerspec its;
+		its.it_interval = m_interval;
+		its.it_value = m_interval;
+		if(timerfd_settime(fdesc, 0, &its, NULL) == -1)
+			throw TimerException("Error starting timer.");
+		return;
+	}
+
+	if(toNanos(m_interval) == 0) {
+		stop();
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &m_deadline);
+	m_deadline = fromNanos(toNanos(m_deadline) + toNanos(m_interval));
+	scheduleWakeup(m_deadline);
 }
 void Timer::stop() {
-	m_its.it_value.tv_sec = 0;
-	m_its.it_value.tv_nsec = 0;
-	if(timer_settime(m_timerid, 0, &m_its, NULL) == -1)
-		throw TimerException("Error stopping timer.");
+	if(m_backend == TIMERFD) {
+		itimerspec its = {{0, 0}, {0, 0}};
+		if(timerfd_settime(fdesc, 0, &its, NULL) == -1)
+			throw TimerException("Error stopping timer.");
+		return;
+	}
+	cancelWakeup();
 }
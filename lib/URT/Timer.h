@@ -21,7 +21,7 @@
 
 #include "FDEvtSource.h"
 #include "urtexcept.h"
-#include <signal.h>
+#include <ctime>
 
 namespace urt {
 
@@ -35,10 +35,18 @@ namespace urt {
   * the interval signal) and required unwieldy and repetitive code.
   *
   * The Timer class acts as a relatively normal FDEvtSource. It keeps track
-  * of time independently of the EventLoop and enables fine-grained control.
-  * In fact, it is possible that the EventLoop interval signal may become
+  * of time independently of the EventLoop's interval and enables fine-grained
+  * control. In fact, it is possible that the EventLoop interval signal may become
   * deprecated in favor of Timer in the future.
   *
+  * By default, Timers are driven by the wakeups of the EventLoop they are added
+  * to (see FDEvtSource::scheduleWakeup); they use no file descriptors, kernel
+  * timers, or threads of their own, so any number may be created cheaply.
+  * Alternatively, the TIMERFD backend makes the source's file descriptor a Linux
+  * timerfd, letting the kernel keep time. In both cases expiration is dispatched
+  * on the EventLoop's thread and getExpirations() reports how many intervals
+  * elapsed since the previous call to onTimeout().
+  *
   * @note Timer behaves differently from the EventLoop interval signal in that
   *	it schedules the next timer event based on when the last timer event
   *	occured, not when it was services. For example, a timer with interval
@@ -48,19 +56,26 @@ namespace urt {
   *
   * @attention Timer does not allow events to accrue; the timer inhibits events
   *	(although it still counts time) between the event occurance and when it
-  *	is serviced. If enough time lapses between the start of the timer and the start
+  *	is serviced. Missed events are instead reported by getExpirations(). If enough time lapses between the start of the timer and the start
   *	of the EventLoop, the timer will trigger at said start.
   */
 class Timer : public FDEvtSource {
 public:
+	/** Mechanism used to keep time. */
+	enum Backend {
+		LOOP,	///< EventLoop wakeups; no file descriptor or kernel timer.
+		TIMERFD	///< Linux timerfd watched as the source's file descriptor.
+	};
+
 	/** Creates a Timer with a given interval.
 	  * The timer starts immediately. If enough time lapses between start and
 	  * the start of the EventLoop, the timer will trigger at said start.
 	  * @param millis Timeout in milliseconds.
 	  * @param start If true, timer is started immediately upon creation.
-	  * @throw TimerException Thrown if unable to create necessary OS primitives.
+	  * @param backend Mechanism used to keep time.
+	  * @throw TimerException Thrown if the TIMERFD backend cannot create or arm its timerfd.
 	  */
-	Timer(unsigned int millis, bool start = true) throw (TimerException);
+	Timer(unsigned int millis, bool start = true, Backend backend = LOOP) throw (TimerException);
 	~Timer();
 	
 	/** Stops the timer. */
@@ -69,7 +84,14 @@ public:
 	void start();
 	/** Resets and starts the timer (same as start()). */
 	void reset() { start(); }
+	/** @return mechanism used to keep time */
+	Backend getBackend() const { return m_backend; }
 protected:
+	/** Number of intervals that elapsed before the current call to onTimeout().
+	  * Normally 1; larger if the EventLoop was too busy to service the timer
+	  * in time. Only meaningful from within onTimeout().
+	  */
+	unsigned long long getExpirations() const { return m_expirations; }
 	/** Called when running and the timer has expired.
 	  * The timer resets itself immediately upon expiration, which can
 	  * and is probably eariler than onTimeout is called.
@@ -78,11 +100,12 @@ protected:
 	virtual bool onTimeout() = 0;
 private:
 	bool onActivity();
-	static void timerThread(sigval_t obj);
+	bool onWakeup();
 	
-	int writePipe; ///< fd for send end of pipe (used by Timer's thread)
-	struct itimerspec m_its;
-	timer_t m_timerid;
+	Backend m_backend;
+	timespec m_interval; ///< Time between expirations; zero never expires
+	timespec m_deadline; ///< Time of next (or most recently missed) expiration (LOOP backend only)
+	unsigned long long m_expirations; ///< Intervals elapsed before current onTimeout()
 };
 
 }
@@ -0,0 +1,109 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VARINT_H_
+#define VARINT_H_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace urt {
+namespace detail {
+
+/**
+ * Lengths in the extended ARD and StateSocket framing are sent as variable-length integers: seven bits per byte, least
+ * significant group first, with the high bit of each byte set if another byte follows. Values below 128 take one byte,
+ * values below 16384 two, and so on.
+ */
+static const size_t VARINT_MAX_BYTES = 5; ///< Enough for 32-bit lengths
+
+/**
+ * Encode a length.
+ * @param value length to encode
+ * @param out buffer of at least VARINT_MAX_BYTES bytes
+ * @return number of bytes written
+ */
+inline size_t encodeVarint(size_t value, unsigned char* out) {
+	size_t n = 0;
+	while(value >= 0x80) {
+		out[n++] = static_cast<unsigned char>(value | 0x80);
+		value >>= 7;
+	}
+	out[n++] = static_cast<unsigned char>(value);
+	return n;
+}
+
+/**
+ * Decode a length.
+ * @param in encoded bytes
+ * @param available number of bytes at \c in
+ * @param value set to the decoded length
+ * @return number of bytes consumed; 0 if more bytes are needed; -1 if the encoding is longer than VARINT_MAX_BYTES
+ */
+inline int decodeVarint(const unsigned char* in, size_t available, size_t& value) {
+	value = 0;
+	for(size_t i = 0; i < VARINT_MAX_BYTES; i++) {
+		if(i == available)
+			return 0;
+		value |= static_cast<size_t>(in[i] & 0x7F) << (7 * i);
+		if(!(in[i] & 0x80))
+			return i + 1;
+	}
+	return -1;
+}
+
+/** Location and size of each key and value in a batch message, in order: key, value, key, value, ... */
+typedef std::vector<std::pair<const char*, size_t> > BatchFields;
+
+/**
+ * Split a batch message, as sent to StateDevice and StateSocket, into its keys and values. The message holds
+ * <tt>{key_size: 1 byte}{key}{value_size: varint}{value}</tt> for each substate.
+ * @param msg message body
+ * @param size length of the message body
+ * @param fields set to the keys and values, which point into \c msg
+ * @return false if the message is malformed, in which case \c fields should not be used
+ */
+inline bool parseBatch(const unsigned char* msg, size_t size, BatchFields& fields) {
+	fields.clear();
+	const unsigned char* p = msg;
+	const unsigned char* const end = msg + size;
+	while(p < end) {
+		const size_t keySize = *p++;
+		if(static_cast<size_t>(end - p) < keySize)
+			return false;
+		fields.push_back(std::make_pair(reinterpret_cast<const char*>(p), keySize));
+		p += keySize;
+
+		size_t valueSize;
+		const int n = decodeVarint(p, end - p, valueSize);
+		if(n <= 0)
+			return false;
+		p += n;
+		if(static_cast<size_t>(end - p) < valueSize)
+			return false;
+		fields.push_back(std::make_pair(reinterpret_cast<const char*>(p), valueSize));
+		p += valueSize;
+	}
+	return true;
+}
+
+}
+}
+
+#endif /* VARINT_H_ */
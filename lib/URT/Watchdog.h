@@ -28,7 +28,7 @@
 
 #include <string>
 #include <boost/utility.hpp>
-#include <boost/signals/trackable.hpp>
+#include "Signal.h"
 #include <ctime>
 
 //class EventLoop;
@@ -68,7 +68,7 @@ namespace urt {
  * by the EventLoop and will not be deleted by it. It may therefore be created on the stack. When the Watchdog dies, the
  * connection with the EventLoop will be automatically severed.
  */
-class Watchdog : public boost::signals::trackable, boost::noncopyable {
+class Watchdog : public Trackable, boost::noncopyable {
 public:
 	/**
 	 * Creates and activates a watchdog for a particular key, associating it with the given EventLoop.
@@ -107,7 +107,7 @@ public:
 	/**
 	 * Deactivates and destroys the watchdog.
 	 */
-	virtual ~Watchdog() {} //Since we derived from boost::signals::trackable, the signal-slot connection
+	virtual ~Watchdog() {} //Since we derived from Trackable, the signal-slot connection
 							//will be automatically deleted upon destruction.
 	/**
 	 * Pure virtual function called when a watchdog timeout occurs. Extend class
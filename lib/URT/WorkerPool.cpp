@@ -0,0 +1,143 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+#include "EventLoop.h"
+#include "Log.h"
+#include <boost/bind.hpp>
+
+using namespace urt;
+
+/**
+ * Create a pool and start its threads.
+ * @param threads number of threads; at least 1
+ * @throws ThreadException thrown if a thread cannot be created
+ */
+WorkerPool::WorkerPool(size_t threads) throw (ThreadException) : stopping(false), alive(new bool(true)) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	for(size_t i = 0; i < (threads ? threads : 1); i++) {
+		pthread_t t;
+		if(pthread_create(&t, NULL, &WorkerPool::threadMain, this) != 0) {
+			shutdown();
+			pthread_cond_destroy(&cond);
+			pthread_mutex_destroy(&mutex);
+			throw ThreadException("Unable to create WorkerPool thread");
+		}
+		this->threads.push_back(t);
+	}
+}
+
+/**
+ * Discard queued jobs, wait for running ones to finish, and cancel their completions.
+ */
+WorkerPool::~WorkerPool() {
+	shutdown();
+	*alive = false;
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * Discard queued jobs and join every thread.
+ */
+void WorkerPool::shutdown() {
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	queue.clear();
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	for(size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	threads.clear();
+}
+
+/**
+ * Run a job on a worker thread. May be called from any thread.
+ * @param job job to run; a std::exception it throws is logged
+ */
+void WorkerPool::submit(const Job& job) {
+	Entry e;
+	e.job = job;
+	e.loop = NULL;
+	pthread_mutex_lock(&mutex);
+	queue.push_back(e);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Run a job on a worker thread, then run a completion on an EventLoop's thread. May be called from any thread.
+ * @param job job to run; a std::exception it throws is logged, and the completion is still run
+ * @param loop loop on which to run the completion
+ * @param completion completion to run once the job has finished
+ */
+void WorkerPool::submit(const Job& job, EventLoop& loop, const Job& completion) {
+	Entry e;
+	e.job = job;
+	e.loop = &loop;
+	e.completion = completion;
+	pthread_mutex_lock(&mutex);
+	queue.push_back(e);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Get a process-wide pool for jobs with no owner to outlive them, such as reaping child processes. It is created on
+ * first use and never destroyed; jobs still running at exit are abandoned.
+ * @return default pool
+ */
+WorkerPool& WorkerPool::getDefault() {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	static WorkerPool* pool;
+	struct Create { static void run() { pool = new WorkerPool(2); } };
+	pthread_once(&once, &Create::run);
+	return *pool;
+}
+
+void* WorkerPool::threadMain(void* p) {
+	WorkerPool* pool = static_cast<WorkerPool*>(p);
+	for(;;) {
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->queue.empty() && !pool->stopping)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if(pool->stopping) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		Entry e = pool->queue.front();
+		pool->queue.pop_front();
+		pthread_mutex_unlock(&pool->mutex);
+
+		try {
+			e.job();
+		} catch(std::exception& ex) {
+			Log::error(std::string("WorkerPool job threw: ") + ex.what());
+		}
+		if(e.loop)
+			e.loop->post(boost::bind(&WorkerPool::complete, pool->alive, e.completion));
+	}
+}
+
+/** Run a completion on its loop's thread unless the pool has since been destroyed. */
+void WorkerPool::complete(const boost::shared_ptr<bool>& alive, const Job& completion) {
+	if(*alive)
+		completion();
+}
@@ -0,0 +1,84 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include "urtexcept.h"
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+namespace urt {
+
+class EventLoop;
+
+/**
+ * A fixed set of threads that run blocking operations (handshakes, sleeps, reaping child processes) so the EventLoop
+ * never has to. A job submitted with a completion runs on a worker thread; its completion is then posted to the given
+ * EventLoop (see EventLoop::post()) and runs on the loop's thread, where it may safely use State and sources.
+ *
+ * Jobs run on other threads, so they must not touch State, signals, or any source attached to an EventLoop. The usual
+ * pattern is for a job to fill in a structure held by a boost::shared_ptr and for its completion to act on the result:
+ * @code
+ * boost::shared_ptr<Result> r(new Result);
+ * pool.submit(boost::bind(&compute, r), loop, boost::bind(&Owner::onComputed, this, r));
+ * @endcode
+ *
+ * Destroying a pool discards queued jobs, waits for running ones, and cancels completions not yet run, so an object
+ * may own a pool and bind completions to itself. Such a pool must be destroyed on its loop's thread.
+ */
+class WorkerPool : boost::noncopyable {
+public:
+	/** Work to run; a job or its completion. */
+	typedef boost::function<void ()> Job;
+
+	WorkerPool(size_t threads = 1) throw (ThreadException);
+	~WorkerPool();
+
+	void submit(const Job& job);
+	void submit(const Job& job, EventLoop& loop, const Job& completion);
+
+	static WorkerPool& getDefault();
+
+private:
+	/** A submitted job and what to do when it finishes. */
+	struct Entry {
+		Job job;
+		EventLoop* loop; ///< Loop on which to run completion; NULL if none
+		Job completion;
+	};
+
+	void shutdown();
+	static void* threadMain(void* pool);
+	static void complete(const boost::shared_ptr<bool>& alive, const Job& completion);
+
+	std::vector<pthread_t> threads;
+	std::deque<Entry> queue; ///< Jobs not yet started; guarded by mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; ///< Signalled when a job is queued or the pool is stopping
+	bool stopping; ///< Guarded by mutex
+	boost::shared_ptr<bool> alive; ///< Cleared on destruction; checked by completions on the loop's thread
+};
+
+}
+
+#endif /* WORKERPOOL_H_ */
@@ -21,20 +21,35 @@
 
 #include "../Log.h"
 #include "../State.h"
-#include <unistd.h>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <cctype>
+#include <ctime>
 using boost::lexical_cast;
 
 using namespace urt::contrib;
 
+static const size_t COMMAND_LINES = 2; ///< Echo and +/- (success or failure)
+static const size_t RESET_LINES = 9; ///< Reset information, then echo, value, and +/- of the watchdog query
+static const size_t BATTERY_LINES = 2; ///< Main and internal battery voltages, after the echo
+
+/** @return true if a is earlier than b */
+static inline bool earlier(const timespec& a, const timespec& b) {
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
 Ax3500::Ax3500(const char* dev) throw (urt::SerialException)
-	: urt::SerialPort(dev, B9600, false, true, CS7, urt::EVEN) {
+	: urt::SerialPort(dev, B9600, false, true, CS7, urt::EVEN), stale(false), resetting(false) {
+	setDrain(false); //commands are short, and nothing depends on when they finish transmitting
+	setQueuedWrites(true); //also makes reads non-blocking
 	reset();
 }
 Ax3500::~Ax3500() {
+	failPending(FutureBase::CANCELLED);
 	//reset(); //Reset so that the controller will stop do anything, for safety!
 	try {
+		//Write synchronously: a queued reset would be appended to whatever is still queued and destroyed with it
+		setQueuedWrites(false);
 		send("%rrrrrr\r", 8); //send reset command
 	} catch(...) {} //There's a chance we're being deleted because the port is bad.
 	//We don't actually call reset(), since reset() also gets the status as well,
@@ -43,13 +58,90 @@ Ax3500::~Ax3500() {
 
 
 void Ax3500::reset() {
+	failPending(FutureBase::CANCELLED); //the controller will not answer them
+	lines.clear();
+	line.clear();
 	send("%rrrrrr\r", 8); //send reset command
-	sleep(1);
-	send("^00\r", 4); //Get the watchdog state along with the standard reset info
-	expectedResponses.push(RESET);
+	resetting = true;
+	clock_gettime(CLOCK_MONOTONIC, &restarted);
+	restarted.tv_sec += 1;
+	scheduleTimeout();
+}
+
+bool Ax3500::onWakeup() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(resetting && !earlier(now, restarted)) {
+		resetting = false;
+		send("^00\r", 4); //Get the watchdog state along with the standard reset info
+		expect(RESET_LINES, QUERY_TIMEOUT, boost::bind(&Ax3500::onResetInfo, this, _1));
+	}
+	for(std::deque<Pending>::iterator p = pending.begin(); p != pending.end(); p++) {
+		if(!earlier(now, p->deadline)) {
+			urt::Log::warn<<"Ax3500 reply overdue; discarding outstanding commands."<<std::endl;
+			failPending(FutureBase::TIMED_OUT);
+			lines.clear();
+			line.clear();
+			stale = true;
+			break;
+		}
+	}
+	scheduleTimeout();
+	return true;
+}
+
+/**
+ * Note that a command was sent and how to handle its reply.
+ * @param lines lines in the reply, including the echo of the command
+ * @param timeout milliseconds to wait for the reply
+ * @param onReply called with the reply, if set
+ * @param onFail called if the reply never comes, if set
+ */
+void Ax3500::expect(size_t lines, unsigned int timeout, const boost::function<void (const Lines&)>& onReply,
+		const boost::function<void (FutureBase::Status)>& onFail) {
+	Pending p;
+	p.lines = lines;
+	p.onReply = onReply;
+	p.onFail = onFail;
+	clock_gettime(CLOCK_MONOTONIC, &p.deadline);
+	p.deadline.tv_sec += timeout / 1000;
+	p.deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if(p.deadline.tv_nsec >= 1000000000L) {
+		p.deadline.tv_sec++;
+		p.deadline.tv_nsec -= 1000000000L;
+	}
+	pending.push_back(p);
+	stale = false;
+	scheduleTimeout();
+}
+
+/**
+ * Fail every outstanding command.
+ */
+void Ax3500::failPending(FutureBase::Status status) {
+	std::deque<Pending> failed;
+	failed.swap(pending);
+	for(std::deque<Pending>::iterator p = failed.begin(); p != failed.end(); p++)
+		if(p->onFail)
+			p->onFail(status);
+}
+
+/**
+ * Schedule a wakeup for the end of a reset or the earliest overdue reply, whichever comes first.
+ */
+void Ax3500::scheduleTimeout() {
+	const timespec* first = resetting ? &restarted : NULL;
+	for(std::deque<Pending>::const_iterator p = pending.begin(); p != pending.end(); p++)
+		if(!first || earlier(p->deadline, *first))
+			first = &p->deadline;
+	if(first)
+		scheduleWakeup(*first);
+	else
+		cancelWakeup();
 }
 
 void Ax3500::resetWatchdog() {
+	if(resetting) return;
 	send("", 1); //send null character
 }
 
@@ -86,6 +178,7 @@ static inline unsigned char fromHex(const char* in) {
 void Ax3500::setSpeed(Channel channel, Direction direction, char speed) throw(std::logic_error) {
 	if(speed > MAX_SPEED || speed < 0)
 		throw std::logic_error("invalid speed given");
+	if(resetting) return;
 
 	char cmd[5];
 	cmd[0] = '!';
@@ -98,8 +191,7 @@ void Ax3500::setSpeed(Channel channel, Direction direction, char speed) throw(st
 	toHex(speed, &cmd[2]);
 	cmd[4] = '\r';
 	send(cmd, 5);
-	
-	expectedResponses.push(COMMAND);
+	expect(COMMAND_LINES, QUERY_TIMEOUT);
 }
 
 void Ax3500::setLinearSpeed(const std::string& key, const std::string& value) {
@@ -111,6 +203,15 @@ try {
 		setSpeed(LINEAR, FORWARD,  speed);
 } catch(...) {} //ignore errors
 }
+void Ax3500::setLinearSpeed(urt::SubstateHandle h) {
+try {
+	const int speed = urt::State::getAs<int>(h);
+	if(speed < 0)
+		setSpeed(LINEAR, REVERSE, -speed);
+	else
+		setSpeed(LINEAR, FORWARD,  speed);
+} catch(...) {} //ignore errors
+}
 void Ax3500::setSteeringSpeed(const std::string& key, const std::string& value) {
 try {
 	int speed = lexical_cast<int>(value);
@@ -120,6 +221,15 @@ try {
 		setSpeed(STEERING, CLOCKWISE, speed);
 } catch(...) {} //ignore errors
 }
+void Ax3500::setSteeringSpeed(urt::SubstateHandle h) {
+try {
+	const int speed = urt::State::getAs<int>(h);
+	if(speed < 0)
+		setSpeed(STEERING, COUNTER,  -speed);
+	else
+		setSpeed(STEERING, CLOCKWISE, speed);
+} catch(...) {} //ignore errors
+}
 
 void Ax3500::setPIDGain(PIDChannel channel, char value) {
 try {
@@ -127,6 +237,7 @@ try {
 		throw std::invalid_argument("channel given is invalid");
 	if(value < 0 || value > MAX_PID_GAIN)
 		throw std::invalid_argument("value given is out of bounds");
+	if(resetting) return;
   
 	char cmd[7];
 	cmd[0] = '^';
@@ -135,93 +246,114 @@ try {
 	toHex(value, &cmd[4]);
 	cmd[6] = '\r';
 	send(cmd, 7);
-	expectedResponses.push(COMMAND);
+	expect(COMMAND_LINES, QUERY_TIMEOUT);
 	
 } catch(...) {} //ignore errors
 }
 
 bool Ax3500::onActivity() {
-	std::string msg;
-	char c;
-	get(&c, 1);
+	char buf[64];
+	size_t r;
+	try {
+		r = getAvailable(buf, sizeof(buf));
+	} catch(urt::SerialException&) {
+		return false;
+	}
 	
-	//we weren't expecting anything, see if the watchdog timedout
-	if(expectedResponses.empty()) {
-		if(c == 'W') //if it did, reset it
-			resetWatchdog();
-		else //Uh-oh. Kill device.
-			return false;
-	} else {
-		while (c != '\r') {
-			msg += c;
-			get(&c, 1);
+	for(size_t i = 0; i < r; i++) {
+		const char c = buf[i];
+		//we weren't expecting anything (the reset information arrives before it is asked for)
+		if(pending.empty() && lines.empty() && line.empty() && !resetting) {
+			if(c == 'W') { //see if the watchdog timed out; if it did, reset it
+				resetWatchdog();
+				continue;
+			}
+			if(stale) //the rest of an overdue reply
+				continue;
+			return false; //Uh-oh. Kill device.
 		}
-		msg += '\n';
-	
-		switch(expectedResponses.front()) {
-			case COMMAND: {
-				get(&c, 1); //get success flag (+ on success, - on failure)
-				get(&c, 1); //skip carriage return
-				//ignore failures
-			} break;
-			case WATCHDOG_RESET: break;
-			case RESET: {
-				//forget the command echo
-				msg.clear();
-				//get next four information lines
-				for(int i = 0; i < 5; i ++) {
-					get(&c, 1);
-					while (c != '\r') {
-						msg += c;
-						get(&c, 1);
-					}
-					msg += '\n';
-				}
-				//forget watchdog request echo
-				get(&c, 1);
-				while (c != '\r') get(&c, 1);
-				//get watchdog info
-				get(&c, 1); //0
-				get(&c, 1); //info byte
-				if(c == '1')
-					urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Watchdog disabled.\n"<<std::endl;
-				else if(c == '2')
-					urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Watchdog enabled.\n"<<std::endl;
-				else
-					urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Not in RS232 mode.\n"<<std::endl;
-				//finish up line
-				get(&c, 1);
-				while (c != '\r') get(&c, 1);
-				//get success line (yeah, we just did a read, but it returns success/failure anyways)
-				get(&c, 1);
-				while (c != '\r') get(&c, 1);
-			} break;
-			case MAIN_BATT: {
-				//forget the command echo
-				msg.clear();
-				//get next two information lines
-				for(int i = 0; i < 2; i ++) {
-					get(&c, 1);
-					while (c != '\r') {
-						msg += c;
-						get(&c, 1);
-					}
-					//We only care about the first line, but we do need to dump the other.
-					if(i == 0)
-						urt::State::set(m_mainBattKey, 55*fromHex(msg.c_str())/256.0);
-					msg += '\n';
-				}
-			} break;
-				
+		if(c == '\r') {
+			lines.push_back(line);
+			line.clear();
+		} else {
+			line += c;
 		}
-		expectedResponses.pop();
 	}
+	
+	//match complete replies to commands, oldest first
+	bool matched = false;
+	while(!pending.empty() && lines.size() >= pending.front().lines) {
+		const Pending p = pending.front();
+		pending.pop_front();
+		const Lines reply(lines.begin(), lines.begin() + p.lines);
+		lines.erase(lines.begin(), lines.begin() + p.lines);
+		matched = true;
+		if(p.onReply)
+			p.onReply(reply);
+	}
+	if(matched)
+		scheduleTimeout();
 	return true;
 }
 
+void Ax3500::onResetInfo(const Lines& reply) {
+	//skip the command echo; then come five information lines, the watchdog query echo, and the watchdog info
+	std::string msg;
+	for(size_t i = 1; i < 6; i++)
+		msg += reply[i] + '\n';
+	const char c = reply[7].size() > 1 ? reply[7][1] : '\0'; //0 followed by info byte
+	if(c == '1')
+		urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Watchdog disabled.\n"<<std::endl;
+	else if(c == '2')
+		urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Watchdog enabled.\n"<<std::endl;
+	else
+		urt::Log::msg<<"Ax3500 reset info:\n"<<msg<<"Not in RS232 mode.\n"<<std::endl;
+}
+
 //Queries
+static void resolveLines(urt::Promise<Ax3500::Lines> p, const Ax3500::Lines& reply) {
+	p.resolve(Ax3500::Lines(reply.begin() + 1, reply.end())); //without the echo
+}
+static void resolveVoltage(urt::Promise<double> p, const urt::Future<Ax3500::Lines>& f) {
+	if(f.isReady())
+		p.resolve(55*fromHex(f.get()[0].c_str())/256.0);
+	else
+		p.fail(f.getStatus());
+}
+
+/**
+ * Send a query and return its reply.
+ * @param command command, without the carriage return
+ * @param lines lines in the reply, not counting the echo of the command
+ * @param timeout milliseconds to wait for the reply
+ * @return lines of the reply, not counting the echo; cancelled if the controller is resetting
+ */
+urt::Future<Ax3500::Lines> Ax3500::query(const std::string& command, size_t lines, unsigned int timeout) {
+	if(resetting)
+		return Future<Lines>();
+	Promise<Lines> p;
+	send((command + '\r').c_str(), command.size() + 1);
+	expect(lines + 1, timeout, boost::bind(&resolveLines, p, _1), boost::bind(&Promise<Lines>::fail, p, _1));
+	return p.getFuture();
+}
+
+/**
+ * Query main battery voltage.
+ * @param timeout milliseconds to wait for the reply
+ * @return voltage
+ */
+urt::Future<double> Ax3500::queryBatteryVoltage(unsigned int timeout) {
+	Promise<double> p;
+	query("?e", BATTERY_LINES, timeout).then(boost::bind(&resolveVoltage, p, _1));
+	return p.getFuture();
+}
+
 void Ax3500::requestBatteryVoltage() {
-	if(m_mainBattKey.empty()) return;
-	send("?e\r", 3);
-	expectedResponses.push(MAIN_BATT);
+	if(m_mainBattKey.empty() || resetting) return;
+	queryBatteryVoltage().then(boost::bind(&Ax3500::onBatteryVoltage, this, _1));
+}
+
+void Ax3500::onBatteryVoltage(const Future<double>& f) {
+	if(f.isReady())
+		urt::State::set(m_mainBattKey, f.get());
 }
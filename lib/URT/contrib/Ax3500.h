@@ -20,21 +20,36 @@
 #define _AX3500_H_
 
 #include "../SerialPort.h"
+#include "../Future.h"
 
+#include <boost/function.hpp>
+#include <ctime>
+#include <deque>
 #include <string>
-#include <queue>
 #include <stdexcept>
+#include <vector>
 
 namespace urt {
+class SubstateHandle;
 namespace contrib {
 
 /**
   * The Ax3500 class represents a physical Roboteq AX3500 motor controller board.
   * It permits client code to access the board over a serial port and issue a
   * variety of commands.
+  *
+  * The controller echoes every command and answers commands in the order they
+  * were sent, so commands are pipelined: each is sent at once, and its reply is
+  * matched by position as it arrives, without ever blocking the EventLoop.
+  * Queries return a Future resolved with the reply. Should any reply be overdue,
+  * the controller is assumed to have lost track; every outstanding command is
+  * failed, and the rest of any late reply is discarded.
   */
 class Ax3500 : public urt::SerialPort {
 public:
+	/** Lines of a reply, without carriage returns. */
+	typedef std::vector<std::string> Lines;
+
 	enum Channel {
 		LINEAR, RIGHT = LINEAR, STEERING, LEFT = STEERING
 	};
@@ -54,6 +69,8 @@ public:
 	static const int MAX_SPEED = 127;
 	/** Maximum PID gain value, inclusive. */
 	static const int MAX_PID_GAIN = 63;
+	/** Default time to wait for a reply, in milliseconds. */
+	static const unsigned int QUERY_TIMEOUT = 1000;
 
 	/** Construct an Ax3500 object and connect to it immediately.
 	  * @note Watchdog mode is saved to the Ax3500's flash memory and
@@ -62,14 +79,18 @@ public:
 	  * @throws urt::SerialException thrown on error
 	  */
 	Ax3500(const char* dev) throw (urt::SerialException);
-	/** Shutdown Ax3500 and disconnect. */
+	/** Shutdown Ax3500 and disconnect. Outstanding queries are cancelled. */
 	~Ax3500();
 	
 	/**
 	 * Reset controller.
-	 * Sends the reset message to the Roboteq.
+	 * Sends the reset message to the Roboteq, then, a second later, asks for its reset information. The wait is a
+	 * wakeup of the EventLoop (see FDEvtSource::scheduleWakeup), so nothing blocks; commands issued while the
+	 * controller is resetting are dropped, since it would not answer them.
 	 */
 	void reset();
+	/** @return true from reset() until the controller has had time to restart */
+	bool isResetting() const { return resetting; }
 	
 	/** Reset watchdog timer on AX3500. */
 	void resetWatchdog();
@@ -89,6 +110,12 @@ public:
 	  * @param value text form of value to set linear/forward channel (negative to indicate reverse direction)
 	  */
 	void setLinearSpeed(const std::string& key, const std::string& value);
+	/**
+	  * Sets linear speed from a numeric substate. Intended to be used as a substate value slot
+	  * (see urt::State::registerValueSlot()); no text conversion occurs if the substate was set as a number.
+	  * @param h substate holding speed (negative to indicate reverse direction)
+	  */
+	void setLinearSpeed(urt::SubstateHandle h);
 	/** Sets right channel (A) speed. Alias for setLinearSpeed(). */
 	inline void setRightSpeed(const std::string& key, const std::string& value) { setLinearSpeed(key, value); }
 	/**
@@ -97,6 +124,11 @@ public:
 	  * @param value text form of value to set linear/forward channel (negative to indicate counter-clockwise direction)
 	  */
 	void setSteeringSpeed(const std::string& key, const std::string& value);
+	/**
+	  * Sets steering speed from a numeric substate. Intended to be used as a substate value slot.
+	  * @param h substate holding speed (negative to indicate counter-clockwise direction)
+	  */
+	void setSteeringSpeed(urt::SubstateHandle h);
 	/** Sets left channel (B) speed. Alias for setSteeringSpeed(). */
 	inline void setLeftSpeed(const std::string& key, const std::string& value) { setSteeringSpeed(key, value); }
 	
@@ -110,9 +142,11 @@ public:
 	
 	
 	/* Queries
-	 * Queries are conducted asynchronously and are put into the registered substate.
+	 * Queries are conducted asynchronously; see above.
 	 */
-	/** Requests main battery voltage.
+	Future<Lines> query(const std::string& command, size_t lines, unsigned int timeout = QUERY_TIMEOUT);
+	Future<double> queryBatteryVoltage(unsigned int timeout = QUERY_TIMEOUT);
+	/** Requests main battery voltage, putting it into the registered substate once it arrives.
 	  * @note Does nothing if key not registered.
 	  */
 	void requestBatteryVoltage();
@@ -122,11 +156,12 @@ public:
 	void registerBatteryVoltage(const std::string& key) { m_mainBattKey = key; }	 
 	
 private:
-	enum ExpectedReponse {
-		COMMAND, ///< Simple echo of command and +,- indicated success or failure
-		WATCHDOG_RESET, ///< Simple echo of command
-		RESET, ///< Initialization string
-		MAIN_BATT ///< Voltage of main battery in special [0,255] form
+	/** A command awaiting its reply. */
+	struct Pending {
+		size_t lines; ///< Lines in the reply, including the echo of the command
+		boost::function<void (const Lines&)> onReply; ///< Called with the reply, if set
+		boost::function<void (FutureBase::Status)> onFail; ///< Called if the reply never comes, if set
+		timespec deadline; ///< When the reply is overdue (CLOCK_MONOTONIC)
 	};
 
 	/**
@@ -134,8 +169,21 @@ private:
 	 * @return true if connection still valid
 	 */
 	bool onActivity();	
+	bool onWakeup();
+	void expect(size_t lines, unsigned int timeout,
+		const boost::function<void (const Lines&)>& onReply = boost::function<void (const Lines&)>(),
+		const boost::function<void (FutureBase::Status)>& onFail = boost::function<void (FutureBase::Status)>());
+	void failPending(FutureBase::Status status);
+	void scheduleTimeout();
+	void onResetInfo(const Lines& reply);
+	void onBatteryVoltage(const Future<double>& f);
 	
-	std::queue<ExpectedReponse> expectedResponses;
+	std::deque<Pending> pending; ///< Commands sent, oldest first
+	Lines lines; ///< Complete lines received but not yet matched to a command
+	std::string line; ///< Partial line received
+	bool stale; ///< True after a reply was overdue, until the next command; unexpected input is discarded
+	bool resetting; ///< True while waiting for the controller to restart
+	timespec restarted; ///< When the controller will have restarted
 	
 	//Registered query keys
 	std::string m_mainBattKey;
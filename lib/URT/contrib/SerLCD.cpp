@@ -30,6 +30,7 @@ const char* SerLCD::bottom = "\376\300";
 const char* SerLCD::clear_bottom = "\376\300                \376\300";
 
 SerLCD::SerLCD(const char* dev) : urt::SerialPort(dev, B9600), heartbeat(0) {
+	setQueuedWrites(true); //the display never answers, so never wait for it
 	std::time(&lastStrobe);
 	(*this)<<clear;
 }
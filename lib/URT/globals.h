@@ -64,6 +64,8 @@
  *				(e.g., /dev/ttyUSB*) and instantiates an objects to represent them.
  * <dt>\ref urt::EventLoop "EventLoop"	<dd> An object that watches StateDevices, StateSockets, and other I/O objects for 
  *				activity and services them accordingly. Generally, only one exists per program.
+ * <dt>\ref urt::Future "Future"	<dd> The eventual reply to a request made to a device, resolved by the EventLoop when
+ *				the reply arrives, or failed after a timeout; continuations attached with then() act on it.
  * <dt>\b App \b ID	<dd> An unsigned char common for all StateDevices of the same type. When StateDevices access a
  *				substate, their App ID and UID are automatically prepended. See UID.
  * <dt>\b UID		<dd> Unit identifier; an unsigned char that enables distinguishing StateDevices of the same type.
@@ -104,6 +106,9 @@
  * using the urt::State::get() or urt::State::set() functions. URT is a static class, meaning all member functions are
  * static; there is no way to instantiate a State object. All code shares the same State, which exists throughout execution.
  *
+ * Code that reads or writes the same substates frequently should look each key up once with urt::State::resolve() and
+ * keep the returned urt::SubstateHandle; the handle overloads of get() and set() skip hashing the key altogether.
+ *
  * Note that changing a substate does not necessarily mean that attached devices will know of the change. Likewise,
  * accessing a substate does not necessarily mean that the information is fresh.
  *
@@ -152,7 +157,8 @@
  * Most URT-based programs will create an EventLoop and a DeviceManager, giving it the rules to use to find StateDevice
  * device files (for example, all files starting with "ttyUSB" in the /dev directory). After calling
  * urt::DeviceManager::execute() to actually execute the rules, the program would call urt::EventLoop::run() to start handling I/O
- * events.
+ * events. The devices found handshake at the same time once the loop runs; a program that must know which devices failed
+ * before going on can pass execute() a function that stops the loop, run the loop, and then examine getFailed().
  *
  * @section three_ways_stuff_happens Three Ways Stuff Happens
  * <ul>
@@ -183,7 +189,8 @@
  * them to the object's onActivity() function. Presently, all event source objects are associated with a particular
  * file descriptor and, as such, are children of the abstract base urt::FDEvtSource. The EventLoop also provides an interval event
  * signal that calls associated slots (see below for more information on the signal-slot system) on a regular interval given on instantiation.
- * Generally, one event loop exists per process, especially since URT is not thread safe.
+ * Generally, one event loop exists per process. Where slow handlers must not delay the rest, urt::EventLoopGroup runs
+ * several loops on their own threads (see below).
  *
  * @section smart_ptr Smart Pointers
  * URT utilizes the Boost smart_ptr library to provide automatic deletion of event sources. The two types
@@ -207,12 +214,15 @@
  * 	you should use either boost::shared_ptr (LockedEvtSourcePtr) or boost::weak_ptr (EvtSourcePtr).
  *
  * @section signal_slot Signal-Slot System
- * While all file descriptor events are dispatched polymorphically, other URT systems use the Boost signals library to provide a signal-slot system.
+ * While all file descriptor events are dispatched polymorphically, other URT systems use urt::Signal, defined in Signal.h, to provide a signal-slot system.
  * A signal is a particular object that can have a variable number of slots attached to it. When the signal is fired, all attached slots will be called.
  * A slot can be a normal function, a static function, or even a member function of a particular object. The interval event system of an EventLoop is managed
  * this way. There is an interval event signal to which slots can be attached using urt::EventLoop::registerIntervalSlot(). Whenever an interval interval has passed,
  * all attached slots will be called.
  *
+ * Registering a slot returns a urt::Connection, which can be used to disconnect it later. A member function slot is disconnected automatically
+ * when its object is destroyed, provided the object derives from urt::Trackable (as every FDEvtSource does).
+ *
  * @section state Global State
  * The urt::State class is a special class; all its members are wholly static. This is formally known as a monostate. There is no way to instantiate a State
  * object; there is always one State and it exists throughout execution. The State object is essentially a hash map between std::string keys and
@@ -230,11 +240,18 @@
  * provides a similar mechanism over a TCP socket.
  *
  * @section threading Thread Safety
- * URT is \b not thread safe. urt::ArdPort and urt::StateSocket both utilize static buffers, urt::State is wholly static, and the use of signals
+ * URT is \b not thread safe. urt::State is wholly static, and the use of signals
  * further complicates the matter. Instead, URT provides the urt::ExternalProgram class, which enables client code to execute another process and
  * interact with its stdin, stdout, and optionally stderr. It permits this by connecting the three to a socket, which can then be interfaced with
  * using a normal socket class, like urt::StateSocket. Essentially, URT permits multiprocessing without permitting multi-threading.
  *
+ * There are two exceptions. First, urt::EventLoop::post() may be called from any thread to run a task on the loop's
+ * thread; it is backed by a lock-free queue (urt::MpscQueue) and an eventfd, so worker threads can hand results to the
+ * loop (and thereby to State) without locks. Second, urt::EventLoopGroup runs several EventLoops on their own threads.
+ * Each source belongs to a single loop and is only touched by its thread; loops hand each other work by posting it.
+ * State stays with one loop, urt::EventLoopGroup::STATE_LOOP, and code on other loops reaches it through the group's
+ * State facade.
+ *
  * @section posix_signal POSIX Signal Safety
  * URT is \b not POSIX signal safe. URT was designed under the assumption that if a system call returns in an unexpected
  * manner (for example, a read call returns with fewer than expected bytes of data), an error of some sort occurred; it does
@@ -268,13 +285,12 @@
   * Therefore, using URT consists of compiling the source code along with your program code and linking the resulting 
   * object code as normal. Note that the following libraries must be linked with your program as well:
   * 	\li rt
-  *	\li boost_signals
   *	\li boost_filesystem
   *	\li boost_system
   *	\li boost_regex
   *	\li pthread
   *
-  * All of the libraries listed after boost_signals can be ignored if your program does not use or link with
+  * All of the boost libraries can be ignored if your program does not use or link with
   * urt::DeviceManager or urt::HotDeviceManager.
   *
   * @note Some operating system installations may use slightly different library names. For example, on our testing
@@ -0,0 +1,134 @@
+/* Copyright 2009-2011 Michael Sechooler
+ *
+ * This file is part of URT.
+ *
+ * URT is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * URT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with URT.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * signalbench.cpp
+ *
+ * Times connecting, firing, and disconnecting urt::Signal against boost::signal, which it replaced, using the
+ * signature of State's value signals. Built only with BUILD_SIGNAL_BENCH; run as <tt>signalbench [iterations]</tt>.
+ */
+
+#include "Signal.h"
+#include <boost/signal.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <ctime>
+
+using std::cout;
+using std::endl;
+
+typedef void Signature(const std::string&, const std::string&);
+
+static unsigned long calls;
+
+void count(const std::string&, const std::string&) {
+	calls++;
+}
+
+struct UrtObserver : public urt::Trackable {
+	void changed(const std::string&, const std::string&) { calls++; }
+};
+
+struct BoostObserver : public boost::signals::trackable {
+	void changed(const std::string&, const std::string&) { calls++; }
+};
+
+static double now() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char* what, double urtTime, double boostTime, unsigned long ops) {
+	cout<<what<<": urt "<<urtTime / ops * 1e9<<" ns, boost "<<boostTime / ops * 1e9<<" ns ("
+		<<boostTime / urtTime<<"x)"<<endl;
+}
+
+/* Connect a free function and disconnect it again */
+static void benchConnect(unsigned long n) {
+	urt::Signal<Signature> urtSignal;
+	double start = now();
+	for(unsigned long i = 0; i < n; i++)
+		urtSignal.connect(&count).disconnect();
+	double urtTime = now() - start;
+
+	boost::signal<Signature> boostSignal;
+	start = now();
+	for(unsigned long i = 0; i < n; i++)
+		boostSignal.connect(&count).disconnect();
+	report("connect+disconnect", urtTime, now() - start, n);
+}
+
+/* Connect a member function of a trackable object and destroy the object */
+static void benchTracked(unsigned long n) {
+	urt::Signal<Signature> urtSignal;
+	double start = now();
+	for(unsigned long i = 0; i < n; i++) {
+		UrtObserver o;
+		urtSignal.connect(&UrtObserver::changed, o);
+	}
+	double urtTime = now() - start;
+
+	boost::signal<Signature> boostSignal;
+	start = now();
+	for(unsigned long i = 0; i < n; i++) {
+		BoostObserver o;
+		boostSignal.connect(boost::bind(&BoostObserver::changed, &o, _1, _2));
+	}
+	report("tracked connect+destroy", urtTime, now() - start, n);
+}
+
+/* Fire a signal with the given number of slots */
+static void benchEmit(unsigned long n, int slots) {
+	const std::string key("key"), value("value");
+	urt::Signal<Signature> urtSignal;
+	boost::signal<Signature> boostSignal;
+	for(int i = 0; i < slots; i++) {
+		urtSignal.connect(&count);
+		boostSignal.connect(&count);
+	}
+
+	double start = now();
+	for(unsigned long i = 0; i < n; i++)
+		urtSignal(key, value);
+	double urtTime = now() - start;
+
+	start = now();
+	for(unsigned long i = 0; i < n; i++)
+		boostSignal(key, value);
+	double boostTime = now() - start;
+
+	cout<<"emit to "<<slots<<(slots == 1 ? " slot" : " slots");
+	report("", urtTime, boostTime, n);
+}
+
+int main(int argc, char* argv[])
+{
+	const unsigned long n = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+	cout<<n<<" iterations; times per iteration"<<endl;
+	benchConnect(n);
+	benchTracked(n);
+	benchEmit(n, 0);
+	benchEmit(n, 1);
+	benchEmit(n, 10);
+	if(calls != n * 22) //11 slots fired n times by each signal
+		cout<<"slot called "<<calls<<" times; expected "<<n * 22<<endl;
+	return 0;
+}
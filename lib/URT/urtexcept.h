@@ -53,6 +53,12 @@ namespace urt
 	  * This exception is extremely rare and indicates a significant underlying issue. */
 	URT_DEFINE_EXCEPTION(TimerException, std::runtime_error);
 
+	/** Generated when a thread, or the means of communicating with it, cannot be created. */
+	URT_DEFINE_EXCEPTION(ThreadException, std::runtime_error);
+
+	/** Generated when asking for the result of a request that has not succeeded (see Future). */
+	URT_DEFINE_EXCEPTION(RequestException, std::runtime_error);
+
 	/*@}*/
 }
 
@@ -6,7 +6,6 @@
 #include <ctime>
 #include <cmath>
 #include "screen.h"
-#include "camera.h"
 #include <limits>
 
 //////////////// Helper Functions
@@ -38,17 +37,25 @@ static double nemaSpaceToDegrees(const std::string& in) {
 			return degrees;
 	}
 }
-static inline double getLong() {
-	return nemaSpaceToDegrees(urt::State::get(LONGITUDE_KEY));
-}
-static inline double getLat() {
-	return nemaSpaceToDegrees(urt::State::get(LATITUDE_KEY));
-}
 
 /////////////// General Class Methods
+AutoPilot::AutoPilot(const Waypoints& waypoints)
+	: waypoints(waypoints), state(INITIALIZING), curWaypoint(waypoints.begin()), coneOnPause(false),
+	  deadmanKey(urt::State::resolve(DEADMAN_KEY)),
+	  bumperKey(urt::State::resolve(BUMPER_KEY)),
+	  compassKey(urt::State::resolve(COMPASS_KEY)),
+	  sonarKey(urt::State::resolve(SONAR_KEY)),
+	  latitudeKey(urt::State::resolve(LATITUDE_KEY)),
+	  longitudeKey(urt::State::resolve(LONGITUDE_KEY)),
+	  driveMotor(urt::State::resolve(DRIVE_MOTOR)),
+	  steerMotor(urt::State::resolve(STEER_MOTOR)),
+	  coneKey(urt::State::resolve(CONE_KEY)),
+	  coneHeadingKey(urt::State::resolve(CONE_HEADING_KEY)),
+	  coneTimeKey(urt::State::resolve(CONE_TIME_KEY)) {}
+
 void AutoPilot::realize() {
 	try {
-	if(!urt::State::getAs<bool>(DEADMAN_KEY)) {
+	if(!urt::State::getAs<bool>(deadmanKey)) {
 		return;
 	}
 	} catch(...) {
@@ -60,14 +67,14 @@ evaluate:
 	switch(state) {
 		case INITIALIZING: {
 			updateLog("AutoPilot", "initializing systems");
-			urt::State::set(DRIVE_MOTOR, NTL_PWM);
-			urt::State::set(STEER_MOTOR, NTL_PWM);
+			urt::State::set(driveMotor, NTL_PWM);
+			urt::State::set(steerMotor, NTL_PWM);
 
 			state = CRUISING;
 			//updateLog("AutoPilot", "cruising");
 		} break;
 		case HONING_ON_CONE: try {
-			if (urt::State::getAs<bool>(BUMPER_KEY)) {
+			if (urt::State::getAs<bool>(bumperKey)) {
 				state = DISENGAGING_FROM_CONE;
 				clock_gettime(CLOCK_MONOTONIC, &firstTime);
 				incrementWaypoint();
@@ -87,17 +94,16 @@ evaluate:
 				}
 			}
 
-			double currentLong = getLong();
-			double currentLat = getLat();
-			double present = northToEast(urt::State::getAs<int>(COMPASS_KEY)/10.0);
+			double currentLong = nemaSpaceToDegrees(urt::State::get(longitudeKey));
+			double currentLat = nemaSpaceToDegrees(urt::State::get(latitudeKey));
+			double present = northToEast(urt::State::getAs<int>(compassKey)/10.0);
 			double desired = newHeading(currentLong, currentLat, curWaypoint->longitude, curWaypoint->latitude);
-			bool coneExists = 0;
-
-
-//			Camera camera;
-			cvReleaseCapture(&camera.capture);
-			camera.capture = cvCaptureFromCAM(0);
-			double camHeading = camera.getCameraHeading(coneExists);
+			//Latest result from the vision pipeline; one from a frame older than CONE_MAX_AGE means no cone
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long coneAge = (long)now.tv_sec * 1000 + now.tv_nsec / 1000000 - urt::State::getAs<long>(coneTimeKey);
+			bool coneExists = urt::State::getAs<bool>(coneKey) && coneAge <= (long)CONE_MAX_AGE;
+			double camHeading = urt::State::getAs<double>(coneHeadingKey);
 
 
 			if (!coneExists) {
@@ -127,13 +133,13 @@ evaluate:
 		} catch(...) {} break;
 		case CRUISING: try {
 			updateLog("AutoPilot", "cruising");
-			double currentLong = getLong();
-			double currentLat = getLat();
-			double present = northToEast(urt::State::getAs<int>(COMPASS_KEY)/10.0);
+			double currentLong = nemaSpaceToDegrees(urt::State::get(longitudeKey));
+			double currentLat = nemaSpaceToDegrees(urt::State::get(latitudeKey));
+			double present = northToEast(urt::State::getAs<int>(compassKey)/10.0);
 			double desired = newHeading(currentLong, currentLat, curWaypoint->longitude, curWaypoint->latitude);
 			updateLog("Desired heading", desired);
 
-			double curSonar = urt::State::getAs<double>(SONAR_KEY);
+			double curSonar = urt::State::getAs<double>(sonarKey);
 
 			if (curSonar < DISTANCE_THRESHOLD_FT && fabs(angularDifference(desired,present)) < 45) {
 				state = OBSTACLE_AVOID;
@@ -153,7 +159,7 @@ evaluate:
 			}
 		} catch(...) {} break;
 		case OBSTACLE_AVOID: {
-			double present = northToEast(urt::State::getAs<int>(COMPASS_KEY)/10.0);
+			double present = northToEast(urt::State::getAs<int>(compassKey)/10.0);
 			if (abs(angularDifference(present,initObstacleAvoidanceHeading)) > 125)
 				mode = LEFT;
 
@@ -162,7 +168,7 @@ evaluate:
 			else if(mode == RIGHT)
 				updateLog("AutoPilot", "avoiding obstacle (right)");
 
-			double curSonar = urt::State::getAs<double>(SONAR_KEY);
+			double curSonar = urt::State::getAs<double>(sonarKey);
 			if (curSonar < DISTANCE_THRESHOLD_FT) {
 				avoidanceHeading = present - mode*atan2(OBSTACLE_BREADTH_FT, curSonar)*180/M_PI;
 				clock_gettime(CLOCK_MONOTONIC, &lastTime);
@@ -170,7 +176,7 @@ evaluate:
 				obstacleDistance = curSonar;
 			}
 
-			int driveNumber = urt::State::getAs<int>(DRIVE_MOTOR);
+			int driveNumber = urt::State::getAs<int>(driveMotor);
 			double speed = -driveNumber/127.0*330.729166666667*2*M_PI*7/12/60; // in feet/second
 
 			timespec curTime;
@@ -200,7 +206,7 @@ evaluate:
 			clock_gettime(CLOCK_MONOTONIC, &curTime);
 
 			double timeDiff = curTime.tv_sec - firstTime.tv_sec + (curTime.tv_nsec - firstTime.tv_nsec)/1e9;
-			int driveNumber = urt::State::getAs<int>(DRIVE_MOTOR);
+			int driveNumber = urt::State::getAs<int>(driveMotor);
 			double speed = -driveNumber/127.0*330.729166666667*2*M_PI*7/12/60; // in feet/second
 
 			if (fabs(speed*timeDiff) > BACKUP_DIST_FT) {
@@ -219,8 +225,8 @@ evaluate:
 }
 
 void AutoPilot::incrementWaypoint() {
-	urt::State::set(DRIVE_MOTOR, NTL_PWM);
-	urt::State::set(STEER_MOTOR, NTL_PWM);
+	urt::State::set(driveMotor, NTL_PWM);
+	urt::State::set(steerMotor, NTL_PWM);
 	if(++curWaypoint == waypoints.end()) {
 		updateLog("AutoPilot", "program complete");;
 		state = DONE;
@@ -241,8 +247,8 @@ void AutoPilot::adjustMotors(double angularOffset, int driveSpeed) {
 	if (driveSpeed < -MAX_DRIVE_PWM)
 		driveSpeed = -MAX_DRIVE_PWM;
 
-	urt::State::set(DRIVE_MOTOR, -driveSpeed);
-	urt::State::set(STEER_MOTOR, steer);
+	urt::State::set(driveMotor, -driveSpeed);
+	urt::State::set(steerMotor, steer);
 }
 
 /////////////// Pathfinding-Specific Class Methods
@@ -4,14 +4,11 @@
 #include "Waypoint.h"
 #include <vector>
 #include <ctime>
-#include "camera.h"
-
-class Camera;
+#include "URT/State.h"
 
 class AutoPilot {
 public:
-	AutoPilot(const Waypoints& waypoints, Camera& camera)
-		: waypoints(waypoints), camera(camera), state(INITIALIZING), curWaypoint(waypoints.begin()), coneOnPause(false) {}
+	AutoPilot(const Waypoints& waypoints);
 	
 	void realize();
 
@@ -42,7 +39,6 @@ private:
 	
 	// General Member Variables
 	const Waypoints& waypoints;
-	Camera& camera;
 	RobotState state;
 	Waypoints::const_iterator curWaypoint;
 	double avoidanceHeading;
@@ -58,6 +54,19 @@ private:
 	AvoidMode mode;
 	bool coneOnPause;
 
+	// Substates consulted every interval; resolved once at construction
+	const urt::SubstateHandle deadmanKey;
+	const urt::SubstateHandle bumperKey;
+	const urt::SubstateHandle compassKey;
+	const urt::SubstateHandle sonarKey;
+	const urt::SubstateHandle latitudeKey;
+	const urt::SubstateHandle longitudeKey;
+	const urt::SubstateHandle driveMotor;
+	const urt::SubstateHandle steerMotor;
+	const urt::SubstateHandle coneKey;
+	const urt::SubstateHandle coneHeadingKey;
+	const urt::SubstateHandle coneTimeKey;
+
 };
 
 #endif
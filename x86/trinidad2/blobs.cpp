@@ -0,0 +1,126 @@
+#include "blobs.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+/* Find the root of a label, halving the path to it on the way */
+int BlobLabeller::find(int label)
+{
+	while(stats[label].parent != label) {
+		stats[label].parent = stats[stats[label].parent].parent;
+		label = stats[label].parent;
+	}
+	return label;
+}
+
+/* Join the blobs of two roots, adding the statistics of the later one to the earlier; returns the new root */
+int BlobLabeller::merge(int a, int b)
+{
+	if(a == b)
+		return a;
+	if(b < a)
+		swap(a, b);
+	Stats& to = stats[a];
+	const Stats& from = stats[b];
+	to.area += from.area;
+	to.sumX += from.sumX;
+	to.sumY += from.sumY;
+	to.x1 = min(to.x1, from.x1);
+	to.y1 = min(to.y1, from.y1);
+	to.x2 = max(to.x2, from.x2);
+	to.y2 = max(to.y2, from.y2);
+	stats[b].parent = a;
+	return a;
+}
+
+/*
+ * Label the blobs within mask's ROI. Coordinates are relative to the ROI. The result is valid until the next call.
+ */
+const vector<Blob>& BlobLabeller::label(const IplImage* mask)
+{
+	CvRect area = cvGetImageROI(mask);
+	stats.clear();
+	previous.clear();
+	for(int y = 0; y < area.height; y++) {
+		const unsigned char* row = (const unsigned char*)mask->imageData + (area.y + y)*mask->widthStep + area.x;
+		current.clear();
+		size_t touching = 0; // First run of the previous row that may touch the next run of this one
+		int x = 0;
+		while(x < area.width) {
+			// Skip background eight pixels at a time
+			uint64_t word;
+			while(x + 8 <= area.width && (memcpy(&word, row + x, 8), word == 0))
+				x += 8;
+			while(x < area.width && !row[x])
+				x++;
+			if(x == area.width)
+				break;
+			Run run;
+			run.start = x;
+			while(x < area.width && row[x])
+				x++;
+			run.end = x - 1;
+
+			// Runs of the previous row within one column (diagonally adjacent) belong to the same blob
+			while(touching < previous.size() && previous[touching].end + 1 < run.start)
+				touching++;
+			run.label = -1;
+			for(size_t i = touching; i < previous.size() && previous[i].start <= run.end + 1; i++) {
+				int root = find(previous[i].label);
+				run.label = run.label < 0 ? root : merge(run.label, root);
+			}
+			if(run.label < 0) {
+				Stats s;
+				s.parent = stats.size();
+				s.area = 0;
+				s.sumX = s.sumY = 0;
+				s.x1 = run.start;
+				s.x2 = run.end;
+				s.y1 = s.y2 = y;
+				run.label = s.parent;
+				stats.push_back(s);
+			}
+
+			long n = run.end - run.start + 1;
+			Stats& s = stats[run.label];
+			s.area += n;
+			s.sumX += n * (run.start + run.end) / 2.0;
+			s.sumY += (double)n * y;
+			s.x1 = min(s.x1, run.start);
+			s.x2 = max(s.x2, run.end);
+			s.y2 = y;
+			current.push_back(run);
+		}
+		previous.swap(current);
+	}
+
+	blobs.clear();
+	for(size_t i = 0; i < stats.size(); i++) {
+		const Stats& s = stats[i];
+		if(s.parent != (int)i)
+			continue;
+		Blob b;
+		b.area = s.area;
+		b.cx = s.sumX / s.area;
+		b.cy = s.sumY / s.area;
+		b.bound = cvRect(s.x1, s.y1, s.x2 - s.x1 + 1, s.y2 - s.y1 + 1);
+		blobs.push_back(b);
+	}
+	return blobs;
+}
+
+/*
+ * Label the blobs within mask's ROI and pick the one with the most pixels. Returns NULL if the mask is empty;
+ * otherwise the blob is valid until the next call.
+ */
+const Blob* BlobLabeller::largest(const IplImage* mask)
+{
+	const vector<Blob>& all = label(mask);
+	const Blob* best = NULL;
+	for(size_t i = 0; i < all.size(); i++)
+		if(!best || all[i].area > best->area)
+			best = &all[i];
+	return best;
+}
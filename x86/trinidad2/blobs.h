@@ -0,0 +1,49 @@
+#ifndef BLOBS_H
+#define BLOBS_H
+
+#include <cv.h>
+#include <vector>
+
+/** A connected group of set pixels in a mask. */
+struct Blob {
+	int area; ///< Pixels in the blob
+	double cx, cy; ///< Centroid
+	CvRect bound; ///< Bounding box
+};
+
+/**
+ * Labels the 8-connected blobs of a binary mask in one pass, without any intermediate image. Each row is split into
+ * runs of set pixels, runs touching a run of the previous row are merged with a union-find, and the statistics of
+ * each blob are accumulated as its runs are found.
+ *
+ * A labeller keeps its buffers between calls, so reusing one for every frame avoids allocating. It may only be used
+ * by one thread at a time.
+ */
+class BlobLabeller {
+public:
+	const std::vector<Blob>& label(const IplImage* mask);
+	const Blob* largest(const IplImage* mask);
+
+private:
+	/** Horizontal run of set pixels: [start, end] */
+	struct Run {
+		int start, end;
+		int label;
+	};
+	/** Statistics of a label; those of merged labels are added to their root. */
+	struct Stats {
+		int parent;
+		long area;
+		double sumX, sumY;
+		int x1, y1, x2, y2;
+	};
+
+	int find(int label);
+	int merge(int a, int b);
+
+	std::vector<Run> previous, current;
+	std::vector<Stats> stats;
+	std::vector<Blob> blobs;
+};
+
+#endif
@@ -1,9 +1,15 @@
 #include "camera.h"
+#include "threshold.h"
+#include "globals.h"
 #include <iostream>
 #include <stdio.h>
 #include <string>
 #include <sys/time.h>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
 #include <limits>
+#include <algorithm>
 #include <libraw1394/raw1394.h>
 
 static void resetBus() {
@@ -25,11 +31,10 @@ static void resetBus() {
 }
 
 Camera::Camera()
-:contours(0),adjustment(0),erosion(2),dilation(5),resWidth(1024),resHeight(768),redRange(70),greenRange(20),blueRange(70)
+:adjustment(0),erosion(2),dilation(5),resWidth(1024),resHeight(768),redRange(70),greenRange(20),blueRange(70),coneSeen(false)
 {
 	resetBus();
 	/* Setup camera capture, grab first frame, and create resultant image */
-	storage = cvCreateMemStorage(0);
 	capture = cvCaptureFromCAM(0);
 
 	// 160 x 120 is the one that always works
@@ -56,16 +61,16 @@ Camera::Camera()
 		CV_Error(CV_StsError, "failed to take initial picture");
 	}
 
-	// Create a result as well as contour image
+	// Create a result image
 	result	= cvCreateImage(cvGetSize(frame), 8, 1);
-	contourimage = cvCreateImage(cvGetSize(frame), 8, 1);
+
+	startCapture();
 }
 Camera::Camera(int rr,int gr,int br,int erosion,int dilation)
-:contours(0),adjustment(0),erosion(erosion),dilation(dilation),resWidth(1024),resHeight(768),redRange(rr),greenRange(gr),blueRange(br)
+:adjustment(0),erosion(erosion),dilation(dilation),resWidth(1024),resHeight(768),redRange(rr),greenRange(gr),blueRange(br),coneSeen(false)
 {
 	resetBus();
 	/* Setup camera capture, grab first frame, and create resultant image */
-	storage = cvCreateMemStorage(0);
 	capture = cvCaptureFromCAM(0);
 
 	// 160 x 120 is the one that always works
@@ -92,27 +97,178 @@ Camera::Camera(int rr,int gr,int br,int erosion,int dilation)
 		CV_Error(CV_StsError, "failed to take initial picture");
 	}
 
-	// Create a result as well as contour image
+	// Create a result image
 	result	= cvCreateImage(cvGetSize(frame), 8, 1);
-	contourimage = cvCreateImage(cvGetSize(frame), 8, 1);
+
+	startCapture();
 }
-// Primary function
-double Camera::getCameraHeading(bool &coneExists)
+Camera::~Camera()
 {
-	coneExists = 0;
-	// Take a picture
-	frame = cvQueryFrame(capture);
+	__atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&frameCond);
+	pthread_mutex_destroy(&frameMutex);
+	pthread_mutex_destroy(&trackMutex);
+	for(int i = 0; i < SEARCH_LEVELS; i++)
+		cvReleaseImage(&pyramid[i]);
+	for(int i = 0; i < 3; i++)
+		cvReleaseImage(&buffers[i]);
+	cvReleaseImage(&result);
+	cvReleaseCapture(&capture);
+}
 
+/* Copy the initial picture into the triple buffer, marked fresh so the first heading uses it, and start capturing */
+void Camera::startCapture()
+{
+	for(int i = 0; i < 3; i++)
+		buffers[i] = cvCloneImage(frame);
+	clock_gettime(CLOCK_MONOTONIC, &stamps[0]);
+	stamps[1] = stamps[2] = coneStamp = stamps[0];
+	pthread_mutex_init(&frameMutex, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&frameCond, &attr);
+	pthread_condattr_destroy(&attr);
+	ready = 0 | FRESH;
+	front = 1;
+	back = 2;
+	frame = buffers[front];
+	stopping = false;
+
+	CvSize size = cvGetSize(frame);
+	for(int i = 0; i < SEARCH_LEVELS; i++) {
+		size.width = (size.width + 1) / 2;
+		size.height = (size.height + 1) / 2;
+		pyramid[i] = cvCreateImage(size, 8, frame->nChannels);
+	}
+	pthread_mutex_init(&trackMutex, NULL);
+	track = cvRect(0, 0, 0, 0);
+	misses = 0;
+	maxMisses = TRACK_MISSES;
 
-	//time_t timeval;
+	if(pthread_create(&thread, NULL, &Camera::captureMain, this) != 0) {
+		CV_Error(CV_StsError, "unable to start capture thread");
+	}
+}
 
+void* Camera::captureMain(void* c)
+{
+	Camera* cam = static_cast<Camera*>(c);
+	while(!__atomic_load_n(&cam->stopping, __ATOMIC_SEQ_CST)) {
+		// cvQueryFrame blocks until the camera delivers the next frame
+		IplImage* grabbed = cvQueryFrame(cam->capture);
+		IplImage* dest = cam->buffers[cam->back];
+		if(!grabbed || grabbed->width != dest->width || grabbed->height != dest->height) {
+			usleep(CAPTURE_RETRY_DELAY);
+			continue;
+		}
+		cvCopy(grabbed, dest);
+		clock_gettime(CLOCK_MONOTONIC, &cam->stamps[cam->back]);
+		// Publish the new frame and take back whichever buffer it replaces (the previous one, if nobody took it)
+		cam->back = __atomic_exchange_n(&cam->ready, cam->back | FRESH, __ATOMIC_SEQ_CST) & ~FRESH;
+		pthread_mutex_lock(&cam->frameMutex);
+		pthread_cond_broadcast(&cam->frameCond);
+		pthread_mutex_unlock(&cam->frameMutex);
+	}
+	return NULL;
+}
 
-	// Set up
-	data = (uchar *)frame->imageData;
-	datar = (uchar *)result->imageData;
+/*
+ * Take the freshest frame from the capture thread, waiting up to timeout milliseconds for one if none has arrived
+ * since the last call. The frame stays valid, and may be modified, until the next call; only one thread may call this.
+ */
+IplImage* Camera::takeFrame(timespec& stamp, int timeout)
+{
+	if(timeout > 0 && !(__atomic_load_n(&ready, __ATOMIC_SEQ_CST) & FRESH)) {
+		timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_mutex_lock(&frameMutex);
+		while(!(__atomic_load_n(&ready, __ATOMIC_SEQ_CST) & FRESH))
+			if(pthread_cond_timedwait(&frameCond, &frameMutex, &deadline) == ETIMEDOUT)
+				break;
+		pthread_mutex_unlock(&frameMutex);
+	}
+	if(!(__atomic_load_n(&ready, __ATOMIC_SEQ_CST) & FRESH))
+		return NULL;
+	front = __atomic_exchange_n(&ready, front, __ATOMIC_SEQ_CST) & ~FRESH;
+	stamp = stamps[front];
+	return buffers[front];
+}
+
+/*
+ * Allow the cone to be missed for the given number of passes in a row before the whole frame is searched again.
+ * With 0, every frame is processed whole at full resolution.
+ */
+void Camera::setTracking(int misses)
+{
+	pthread_mutex_lock(&trackMutex);
+	maxMisses = misses;
+	pthread_mutex_unlock(&trackMutex);
+}
+
+/* Choose what the next pass processes: the area around the cone while tracking it, else the whole frame */
+Camera::Region Camera::nextRegion()
+{
+	Region region;
+	region.rect = cvRect(0, 0, buffers[0]->width, buffers[0]->height);
+	region.level = 0;
+	pthread_mutex_lock(&trackMutex);
+	if(maxMisses > 0) {
+		if(track.width > 0 && misses < maxMisses) {
+			// The cone may have moved further the longer it has been missed
+			int margin = std::max(std::max(track.width, track.height), (int)TRACK_MARGIN) * (misses + 1);
+			int x1 = std::max(track.x - margin, 0);
+			int y1 = std::max(track.y - margin, 0);
+			int x2 = std::min(track.x + track.width + margin, region.rect.width);
+			int y2 = std::min(track.y + track.height + margin, region.rect.height);
+			region.rect = cvRect(x1, y1, x2 - x1, y2 - y1);
+		} else {
+			region.level = SEARCH_LEVELS;
+		}
+	}
+	pthread_mutex_unlock(&trackMutex);
+	return region;
+}
+
+void Camera::updateTrack(bool found, const CvRect& bound)
+{
+	pthread_mutex_lock(&trackMutex);
+	if(found) {
+		track = bound;
+		misses = 0;
+	} else if(misses < maxMisses) {
+		misses++;
+	}
+	pthread_mutex_unlock(&trackMutex);
+}
+
+/*
+ * Mark the pixels of frame whose rgb values are within each range in mask, over the region returned. Only that part
+ * of mask (at its top-left corner if downsampled) is written, and it is left as mask's ROI for the later stages.
+ */
+Camera::Region Camera::threshold(IplImage* frame, IplImage* mask)
+{
+	Region region = nextRegion();
+	IplImage* source = frame;
+	cvResetImageROI(mask);
+	if(region.level > 0) {
+		for(int i = 0; i < region.level; i++) {
+			cvPyrDown(source, pyramid[i]);
+			source = pyramid[i];
+		}
+		cvSetImageROI(mask, cvRect(0, 0, source->width, source->height));
+	} else {
+		cvSetImageROI(frame, region.rect);
+		cvSetImageROI(mask, region.rect);
+	}
 
-	// Save the initial picture
-	//cvSaveImage("picture.jpeg",frame);
 	// r 255
 	// g 117
 	// b 0
@@ -131,102 +287,92 @@ double Camera::getCameraHeading(bool &coneExists)
 	//		    a b value < idealBlue + blueRange
 
 
-	// Iterate through every pixel looking for rgb values within each range
-	for(int i = 0; i < (frame->height); i++) {
-		for(int j = 0; j < (frame->width); j++) {
-			if((data[i*frame->widthStep+j*frame->nChannels+2] > (idealRed-redRange)) && 		// red value > 255-125
-			   (data[i*frame->widthStep+j*frame->nChannels+1] < (idealGreen+greenRange)) && 	// green value < 117+40
-			   (data[i*frame->widthStep+j*frame->nChannels]   < (idealBlue+blueRange))) 		// blue value < 0 + 100
-				datar[i*result->widthStep+j*result->nChannels] = 255;
-			else
-				datar[i*result->widthStep+j*result->nChannels] = 0;
-		}
-	}
-
-
-
-	//std::cout << "Color change complete.\n";
+	// Mark every pixel with rgb values within each range (vectorized where the CPU allows)
+	thresholdBGR(source, mask, idealRed-redRange, idealGreen+greenRange, idealBlue+blueRange);
+	cvResetImageROI(frame);
+	return region;
+}
 
-	/* Apply erosion and dilation to eliminate some noise and even out blob */
+/* Apply erosion and dilation to eliminate some noise and even out blob, scaled to the region's resolution */
+void Camera::morphology(IplImage* mask, const Region& region) const
+{
 	if(erosion >= 0) {
-		cvErode(result,result,0,erosion);
+		cvErode(mask,mask,0,erosion >> region.level);
 	}
 	if(dilation >= 0) {
-		cvDilate(result,result,0,dilation);
+		cvDilate(mask,mask,0,dilation >> region.level);
 	}
+}
 
-	//std::cout << "Erosion and dilation complete.\n";
-
-	/* FindContours should not alter result (its const in the function declaration), but it does...
-	This function looks for contours (edges of polygons) on the already monochrome image */
-	cvFindContours(result,storage,&contours);
-
-	/* Draw the contours on contourimage */
-	if(contours) {
-		cvDrawContours(contourimage,contours,cvScalarAll(255),cvScalarAll(255),100);
+/*
+ * Find the largest blob threshold() marked in mask for a region, its bounding rectangle in full-resolution
+ * coordinates, and the cone's heading relative to the camera. Returns whether there is a cone at all.
+ */
+bool Camera::locate(const IplImage* mask, const Region& region, double& heading, CvRect& bound)
+{
+	/* Label the blobs of the already monochrome image in one pass; coordinates are relative to mask's ROI */
+	const Blob* cone = blobs.largest(mask);
+
+	/* Check if there is a blob in frame */
+	if (!cone) {
+//		heading = std::numeric_limits<double>::quiet_NaN();
+		heading = 0;
+		bound = cvRect(0, 0, 0, 0);
+		updateTrack(false, bound);
+		return false;
 	}
 
-	//std::cout << "Contour drawing complete.\n";
-
-	//time(&timeval);
-	//std::string filename("boxes.jpeg");
-	//filename = filename + ctime(&timeval);
-	//cvSaveImage(filename.c_str(),contourimage);
-//	cvSaveImage("boxes.jpeg",contourimage);
-
-
-
-
-	//std::cout << "Countour image saved.\n";
-
-	/* Calculate the bounding rectangle */
-	bound = cvBoundingRect(contourimage,0);
-
-	//std::cout << "Bounding rectangle computed.\n";
+	bound.x = region.rect.x + (cone->bound.x << region.level);
+	bound.y = region.rect.y + (cone->bound.y << region.level);
+	bound.width = cone->bound.width << region.level;
+	bound.height = cone->bound.height << region.level;
+	updateTrack(true, bound);
+
+	// The blob's centroid, in full-resolution coordinates
+	double center = region.rect.x + (cone->cx + 0.5) * (1 << region.level) - 0.5;
+
+	double fieldDegrees = 43.3;
+	double halfField = fieldDegrees/2;
+	heading = center/buffers[0]->width*fieldDegrees - halfField;
+	if(heading == -0)
+		heading = 0;
+	return true;
+}
 
-	/* Reset the contourimage image (otherwise contourimage turns into an Etch A Sketch) */
-	if(contours) {
-		//delete contours;
-		//contours = new CvSeq;
-		//cvZero(contours);
-		cvClearSeq(contours);
+// Primary function
+double Camera::getCameraHeading(bool &coneExists)
+{
+	// Take the freshest frame from the capture thread; if none has arrived since the last call, the last answer stands
+	// unless its frame is older than CONE_MAX_AGE
+	timespec stamp;
+	IplImage* fresh = takeFrame(stamp, 0);
+	if(!fresh) {
+		clock_gettime(CLOCK_MONOTONIC, &stamp);
+		long age = (stamp.tv_sec - coneStamp.tv_sec) * 1000 + (stamp.tv_nsec - coneStamp.tv_nsec) / 1000000;
+		coneExists = coneSeen && age <= (long)CONE_MAX_AGE;
+		return adjustment;
 	}
+	frame = fresh;
+	coneStamp = stamp;
 
-	cvZero(contourimage);
-
-	//std::cout << "Countour image zeroed.\n";
-
-	/* Calculate the bounding rectangle's top-left and bottom-right vertex */
-	p1.x = bound.x;
-	p2.x = bound.x + bound.width;
-	p1.y = bound.y;
-	p2.y = bound.x + bound.height;
-
-	//std::cout << "Bound calculations complete.\n";
-
-
-
-
-
-	/* Check if there is a rectangle in frame */
-	if (p1.x == 0 && p1.y == 0) {
-
-
-		//cvSaveImage("picture.jpeg",frame);
-		cvReleaseCapture(&capture);
-//		adjustment = std::numeric_limits<double>::quiet_NaN();
-		adjustment = 0;
-		coneExists = 0;
-		return adjustment;
+	// Save the initial picture
+	//cvSaveImage("picture.jpeg",frame);
 
-	} else {
+	Region region = threshold(frame, result);
+	morphology(result, region);
+	coneSeen = coneExists = locate(result, region, adjustment, bound);
 
+	if(coneExists) {
+		/* Calculate the bounding rectangle's top-left and bottom-right vertex */
+		p1.x = bound.x;
+		p2.x = bound.x + bound.width;
+		p1.y = bound.y;
+		p2.y = bound.x + bound.height;
 
 		// Draw the bounding rectangle on the original image
 		cvRectangle(frame,p1,p2,CV_RGB(255,0,0),3,8,0);
 
 		// Calculate where the center of the rectangle would be
-		// Add half of the bounding rectangle's width to the top-left point's x-coordinate
 		p1.x = bound.x + (bound.width/2);
 
 		// Add half of the difference between top and bottom edge to the bottom edge
@@ -235,31 +381,8 @@ double Camera::getCameraHeading(bool &coneExists)
 		// Draw a small circle at the center of the bounding rectangle
 		cvCircle(frame,p1,3,CV_RGB(0,0,255),1,8,0);
 
-
-
-		/* Check if there is a rectangle in frame */
-		double fieldDegrees = 43.3;
-		double halfField = fieldDegrees/2;
-		adjustment = (double)p1.x;
-		adjustment = adjustment/frame->width;
-		adjustment = adjustment*fieldDegrees;
-		adjustment = adjustment-halfField;
-		if(adjustment == -0)
-				adjustment = 0;
-
-
-
-
-		cvZero(result);
-
 	//	cvSaveImage("picture.jpeg",frame);
-
-
-		cvReleaseCapture(&capture);
-
-		coneExists = 1;
-
-
-		return adjustment;
 	}
+
+	return adjustment;
 }
@@ -3,8 +3,24 @@
 
 #include "cv.h"
 #include "highgui.h"
+#include "blobs.h"
+#include <boost/utility.hpp>
+#include <pthread.h>
+#include <ctime>
 
-class Camera {
+/**
+ * Finds the cone in frames from the FireWire camera. The camera is opened once and a capture thread keeps grabbing
+ * frames into a triple buffer, so getCameraHeading() never waits on the camera: it takes the freshest complete
+ * frame, while the thread fills another and a third holds the newest one not yet taken.
+ *
+ * getCameraHeading() runs every stage of detection on the calling thread. Vision instead runs the stages (takeFrame(),
+ * threshold(), morphology(), and locate()) on threads of their own; the two must not be used together.
+ *
+ * Once the cone has been found, only a region around it is processed, at full resolution. If it is missed in that
+ * region for a number of frames in a row (see setTracking()), the whole frame is searched again, but downsampled
+ * SEARCH_LEVELS times so that a candidate is found cheaply; the next frame then tracks it at full resolution.
+ */
+class Camera : boost::noncopyable {
 	public:
 		/**
 		 * Constructor.
@@ -13,18 +29,43 @@ class Camera {
 		Camera();
 		// Same thing but with different rgb ranges
 		Camera(int rr,int gr, int br, int erosion, int dilation);
+		~Camera();
 		/**
 		 * .
 		 *
 		 */
 		double getCameraHeading(bool &coneExists);
 		int takePicture();
-		CvCapture* capture;
+
+		/** Part of a frame one detection pass works on. */
+		struct Region {
+			CvRect rect; ///< Area of the full-resolution frame
+			int level; ///< Pyramid level processed; each halves the resolution
+		};
+
+		// Detection stages; each may be used by one thread at a time
+		IplImage* takeFrame(timespec& stamp, int timeout);
+		Region threshold(IplImage* frame, IplImage* mask);
+		void morphology(IplImage* mask, const Region& region) const;
+		bool locate(const IplImage* mask, const Region& region, double& heading, CvRect& bound);
+
+		void setTracking(int misses);
+		/** @return size of every frame and of the masks the stages work on */
+		CvSize getFrameSize() const { return cvGetSize(buffers[0]); }
 
 		//void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 	private:
+		static const int FRESH = 4; ///< Set in ready while its buffer has not been taken
+		static const int CAPTURE_RETRY_DELAY = 10000; ///< Microseconds to wait after a failed capture
+		static const int SEARCH_LEVELS = 2; ///< Pyramid levels above full resolution searched when not tracking
+		static const int TRACK_MISSES = 5; ///< Default frames the cone may be missed before searching again
+		static const int TRACK_MARGIN = 32; ///< Least margin, in pixels, kept around the cone when tracking
+
+		void startCapture();
+		static void* captureMain(void* camera);
+		Region nextRegion();
+		void updateTrack(bool found, const CvRect& bound);
 
-		CvSeq* contours;
 		double adjustment;
 
 
@@ -39,15 +80,30 @@ class Camera {
 		int greenRange;
 		int blueRange;
 
-		uchar *data,*datar;
-		CvMemStorage* storage;
 //		CvCapture* capture;
 		CvRect bound;
 		CvPoint p1,p2;
-		IplImage* frame;
+		IplImage* frame; ///< Frame being processed; always buffers[front]
 		IplImage* result;
-		IplImage* contourimage;
+		BlobLabeller blobs; ///< Only touched by locate()
+		bool coneSeen; ///< Whether the last frame processed contained a cone
+		timespec coneStamp; ///< When the last frame processed was captured
 
+		CvCapture* capture; ///< Only touched by the capture thread once it has started
+		IplImage* buffers[3];
+		timespec stamps[3]; ///< When each buffer's frame was captured
+		int front; ///< Buffer takeFrame() last returned; only touched by its caller
+		int back; ///< Buffer being captured into; only touched by the capture thread
+		int ready; ///< Most recently captured buffer, or'd with FRESH; exchanged atomically by both
+		bool stopping; ///< Tells the capture thread to exit; accessed atomically
+		pthread_mutex_t frameMutex;
+		pthread_cond_t frameCond; ///< Broadcast whenever a frame is captured, for takeFrame() to wait on
+		pthread_t thread;
 
+		IplImage* pyramid[SEARCH_LEVELS]; ///< Downsampled frames; only touched by threshold()
+		pthread_mutex_t trackMutex; ///< Guards the members below, shared by threshold() and locate()
+		CvRect track; ///< Where the cone was last found; empty if never
+		int misses; ///< Passes since then that did not find it
+		int maxMisses; ///< Misses allowed before searching the whole frame; 0 never tracks
 };
 #endif
@@ -1,6 +1,7 @@
 #include "globals.h"
 
 const unsigned int INTERVAL_TIMEOUT = 50;
+const unsigned int CONE_MAX_AGE = 4 * INTERVAL_TIMEOUT; // ms; older cone sightings are ignored
 const int STEP_PWM = 2;
 const int MAX_DRIVE_PWM = 43;
 const int MIN_DRIVE_PWM = 0;
@@ -11,6 +11,7 @@ using namespace std;
 // Global Constants related to URT
 const unsigned int WATCHDOG_TIMEOUT = 1000;
 extern const unsigned int INTERVAL_TIMEOUT;
+extern const unsigned int CONE_MAX_AGE;
 const unsigned short PORT = 4444;
 
 #define _(x) x,(sizeof(x)-1)
@@ -24,6 +25,9 @@ const std::string SONAR_KEY(_("A\0sonarft"));
 const std::string DEADMAN_KEY(_("A\0deadman"));
 const std::string LM_12V_KEY("_+12V");
 const std::string MOTOR_BATTERY_KEY("_motorv");
+const std::string CONE_KEY("_cone");
+const std::string CONE_HEADING_KEY("_coneheading");
+const std::string CONE_TIME_KEY("_conetime");
 extern const int STEP_PWM;
 extern const int MAX_DRIVE_PWM;
 extern const int MAX_STEER_PWM;
@@ -20,6 +20,7 @@
 #include "AutoPilot.h"
 #include "screen.h"
 #include "camera.h"
+#include "vision.h"
 
 #include <iostream>
 #include <string>
@@ -46,21 +47,31 @@ std::string formatTime() {
 }
 
 void printStats() {
+	//resolved on first call rather than at static initialization, when State may not yet exist
+	static const urt::SubstateHandle drive = urt::State::resolve(DRIVE_MOTOR);
+	static const urt::SubstateHandle steer = urt::State::resolve(STEER_MOTOR);
+	static const urt::SubstateHandle compass = urt::State::resolve(COMPASS_KEY);
+	static const urt::SubstateHandle latitude = urt::State::resolve(LATITUDE_KEY);
+	static const urt::SubstateHandle longitude = urt::State::resolve(LONGITUDE_KEY);
+	static const urt::SubstateHandle utc = urt::State::resolve(std::string("1\0utc",5));
+	static const urt::SubstateHandle hDilution = urt::State::resolve(std::string("1\0hDilution",11));
+	static const urt::SubstateHandle sonar = urt::State::resolve(SONAR_KEY);
+	static const urt::SubstateHandle lm12V = urt::State::resolve(LM_12V_KEY);
 try {
 	const std::string time = formatTime();
 	urt::Log::msg<<"\n\n"<<"Time: "<<time;
 	updateStat("Time", time);
-	updateLog("Drive motor", urt::State::get(DRIVE_MOTOR));
-	updateLog("Steer motor", urt::State::get(STEER_MOTOR));
-	const double northern = urt::State::getAs<int>(COMPASS_KEY)/10.0;
+	updateLog("Drive motor", urt::State::get(drive));
+	updateLog("Steer motor", urt::State::get(steer));
+	const double northern = urt::State::getAs<int>(compass)/10.0;
 	const double present = (northern <= 90)?(90 - northern):(450 - northern);
 	updateLog("Current heading", present);;
-	updateLog("Latitude", urt::State::get(LATITUDE_KEY));
-	updateLog("Longitude", urt::State::get(LONGITUDE_KEY));
-	updateLog("UTC", urt::State::get(std::string("1\0utc",5)));
-	updateLog("HDOP (m)", urt::State::getAs<double>(std::string("1\0hDilution",11)) * 6);
-	updateLog("Sonar (ft.)", urt::State::get(SONAR_KEY));
-	updateLog("Computer +12V", urt::State::get(LM_12V_KEY));
+	updateLog("Latitude", urt::State::get(latitude));
+	updateLog("Longitude", urt::State::get(longitude));
+	updateLog("UTC", urt::State::get(utc));
+	updateLog("HDOP (m)", urt::State::getAs<double>(hDilution) * 6);
+	updateLog("Sonar (ft.)", urt::State::get(sonar));
+	updateLog("Computer +12V", urt::State::get(lm12V));
 	//updateLog("Motor battery", urt::State::get(MOTOR_BATTERY_KEY));
 	
 	urt::Log::msg.flush();
@@ -72,17 +83,20 @@ std::ostream& urt::Log::warn = getAutoLog();
 std::ostream& urt::Log::err = getAutoLog();
 
 void deadman(const std::string& key, const std::string& value) {
+	static const urt::SubstateHandle deadmanKey = urt::State::resolve(DEADMAN_KEY);
+	static const urt::SubstateHandle driveMotor = urt::State::resolve(DRIVE_MOTOR);
+	static const urt::SubstateHandle steerMotor = urt::State::resolve(STEER_MOTOR);
 	static int drive = NTL_PWM, steer = NTL_PWM;
-	const bool d = !urt::State::getAs<bool>(DEADMAN_KEY);
+	const bool d = !urt::State::getAs<bool>(deadmanKey);
 
 	if (d) {
-		drive = urt::State::getAs<int>(DRIVE_MOTOR);
-		steer = urt::State::getAs<int>(STEER_MOTOR);
-		urt::State::set(DRIVE_MOTOR, NTL_PWM);
-		urt::State::set(STEER_MOTOR, NTL_PWM);
+		drive = urt::State::getAs<int>(driveMotor);
+		steer = urt::State::getAs<int>(steerMotor);
+		urt::State::set(driveMotor, NTL_PWM);
+		urt::State::set(steerMotor, NTL_PWM);
 	} else {
-		urt::State::set(DRIVE_MOTOR, drive);
-		urt::State::set(STEER_MOTOR, steer);
+		urt::State::set(driveMotor, drive);
+		urt::State::set(steerMotor, steer);
 	}
 	updateLog("Dead man's switch", d);
 }
@@ -122,6 +136,8 @@ try {
 	//Start URT subsystem
 	urt::Log::message("Starting Trinidad");
 	urt::EventLoop loop(INTERVAL_TIMEOUT);
+	//Coalesce State notifications per iteration so, e.g., the motor controller only receives the final speeds
+	loop.setStateBatching(true);
 
 	//Setup deadman switch
 	urt::State::registerSlot(DEADMAN_KEY, deadman);
@@ -137,8 +153,10 @@ try {
 	{ //Pointer should not really be used after adding to loop. We'll make it go out of scope.
 	urt::HotDeviceManager* dm = new urt::HotDeviceManager(loop);
 	dm->addDirectory("/dev", "ttyUSB[[:digit:]]+");
-	dm->execute(loop);
+	//Every device handshakes at once; run the loop until they have all answered or failed
+	dm->execute(loop, boost::bind(&urt::EventLoop::stop, &loop));
 	loop.add(dm);
+	loop.run();
 	
 	switch(dm->getFailed().size()) {
 	case 0:
@@ -150,8 +168,8 @@ try {
 		urt::contrib::Ax3500* ax3500 = new urt::contrib::Ax3500(dm->getFailed().front().c_str());
 		loop.add(ax3500);
 		//For some reason, our robot's current configuration is such that the channels are reversed.
-		urt::State::registerSlot(STEER_MOTOR, &urt::contrib::Ax3500::setLinearSpeed, *ax3500);
-		urt::State::registerSlot(DRIVE_MOTOR, &urt::contrib::Ax3500::setSteeringSpeed, *ax3500);
+		urt::State::registerValueSlot(urt::State::resolve(STEER_MOTOR), &urt::contrib::Ax3500::setLinearSpeed, *ax3500);
+		urt::State::registerValueSlot(urt::State::resolve(DRIVE_MOTOR), &urt::contrib::Ax3500::setSteeringSpeed, *ax3500);
 		//No watchdog reset is necessary since we'll be asking for the battery voltage with enough frequency.
 		//ax3500->registerBatteryVoltage(MOTOR_BATTERY_KEY);
 		//loop.registerIntervalSlot(&urt::contrib::Ax3500::requestBatteryVoltage, *ax3500);
@@ -168,8 +186,11 @@ try {
 	loop.add(new urt::SocketServer<urt::StateSocket>(PORT,&loop));
 	urt::Log::msg<<"All devices loaded.\nListening on port "<<PORT<<".\nInitializing automation systems."<<std::endl;
 	
+	//Find the cone on threads of its own; AutoPilot reads the results from State
+	Vision vision(cam, loop);
+
 	//Create AutoPilot
-	AutoPilot autopilot(waypoints,cam);
+	AutoPilot autopilot(waypoints);
 	loop.registerIntervalSlot(boost::bind(&AutoPilot::realize, &autopilot));
 	
 	//Setup other stuff
@@ -0,0 +1,244 @@
+#include "threshold.h"
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define THRESHOLD_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// The vector kernels test every byte of a block against the bounds of its channel, which repeat every three bytes,
+// as lo <= x <= hi using unsigned max/min. That leaves one flag per byte; a pixel is in range only if all three of its
+// flags are set. The flags are gathered into a bitmask with movemask, and TRIPLETS turns each 12 bits (4 pixels) of
+// it into 4 mask bytes.
+
+namespace {
+
+/** Inclusive per-byte bounds for 32 BGR pixels; byte i belongs to channel i % 3. */
+struct Bounds {
+	bool empty; ///< True if no pixel can be in range
+	unsigned char lo[96];
+	unsigned char hi[96];
+};
+
+typedef void (*RowKernel)(const unsigned char* src, unsigned char* dst, int width, const Bounds& b);
+
+uint32_t TRIPLETS[4096];
+
+struct BuildTriplets {
+	BuildTriplets() {
+		for(uint32_t v = 0; v < 4096; v++) {
+			TRIPLETS[v] = 0;
+			for(int k = 0; k < 4; k++)
+				if(((v >> (3*k)) & 7) == 7)
+					TRIPLETS[v] |= 0xFFu << (8*k);
+		}
+	}
+} buildTriplets;
+
+void makeBounds(Bounds& b, int minRed, int maxGreen, int maxBlue)
+{
+	// x > minRed is x >= minRed+1; x < max is x <= max-1
+	int lo[3] = {0, 0, minRed + 1};
+	int hi[3] = {maxBlue - 1, maxGreen - 1, 255};
+	b.empty = false;
+	for(int c = 0; c < 3; c++) {
+		if(lo[c] > 255 || hi[c] < 0 || lo[c] > hi[c])
+			b.empty = true;
+		lo[c] = lo[c] < 0 ? 0 : lo[c];
+		hi[c] = hi[c] > 255 ? 255 : hi[c];
+	}
+	for(int i = 0; i < 96; i++) {
+		b.lo[i] = lo[i % 3];
+		b.hi[i] = hi[i % 3];
+	}
+}
+
+inline void scalarPixels(const unsigned char* src, unsigned char* dst, int from, int to, const Bounds& b)
+{
+	for(int j = from; j < to; j++) {
+		const unsigned char* p = src + 3*j;
+		dst[j] = (p[0] >= b.lo[0] && p[0] <= b.hi[0] &&
+			p[1] >= b.lo[1] && p[1] <= b.hi[1] &&
+			p[2] >= b.lo[2] && p[2] <= b.hi[2]) ? 255 : 0;
+	}
+}
+
+inline void storeTriplets(unsigned char* dst, uint64_t bits, int groups)
+{
+	for(int k = 0; k < groups; k++) {
+		uint32_t out = TRIPLETS[(bits >> (12*k)) & 0xFFF];
+		memcpy(dst + 4*k, &out, 4);
+	}
+}
+
+void scalarRow(const unsigned char* src, unsigned char* dst, int width, const Bounds& b)
+{
+	scalarPixels(src, dst, 0, width, b);
+}
+
+#ifdef __SSE2__
+inline __m128i inRange16(__m128i x, __m128i lo, __m128i hi)
+{
+	return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, lo), x), _mm_cmpeq_epi8(_mm_min_epu8(x, hi), x));
+}
+
+void sse2Row(const unsigned char* src, unsigned char* dst, int width, const Bounds& b)
+{
+	__m128i lo[3], hi[3];
+	for(int v = 0; v < 3; v++) {
+		lo[v] = _mm_loadu_si128((const __m128i*)(b.lo + 16*v));
+		hi[v] = _mm_loadu_si128((const __m128i*)(b.hi + 16*v));
+	}
+	int j = 0;
+	for(; j + 16 <= width; j += 16) {
+		const unsigned char* p = src + 3*j;
+		uint64_t bits = 0;
+		for(int v = 0; v < 3; v++) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(p + 16*v));
+			bits |= (uint64_t)(uint32_t)_mm_movemask_epi8(inRange16(x, lo[v], hi[v])) << (16*v);
+		}
+		storeTriplets(dst + j, bits, 4);
+	}
+	scalarPixels(src, dst, j, width, b);
+}
+#endif
+
+#ifdef THRESHOLD_AVX2
+__attribute__((target("avx2")))
+void avx2Row(const unsigned char* src, unsigned char* dst, int width, const Bounds& b)
+{
+	__m256i lo[3], hi[3];
+	for(int v = 0; v < 3; v++) {
+		lo[v] = _mm256_loadu_si256((const __m256i*)(b.lo + 32*v));
+		hi[v] = _mm256_loadu_si256((const __m256i*)(b.hi + 32*v));
+	}
+	int j = 0;
+	for(; j + 32 <= width; j += 32) {
+		const unsigned char* p = src + 3*j;
+		uint32_t m[3];
+		for(int v = 0; v < 3; v++) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(p + 32*v));
+			__m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, lo[v]), x),
+				_mm256_cmpeq_epi8(_mm256_min_epu8(x, hi[v]), x));
+			m[v] = (uint32_t)_mm256_movemask_epi8(ok);
+		}
+		// 96 flag bits: the first 60 (20 pixels) from m[0] and m[1], the rest starting at bit 60
+		uint64_t low = m[0] | (uint64_t)m[1] << 32;
+		uint64_t high = (low >> 60) | (uint64_t)m[2] << 4;
+		storeTriplets(dst + j, low, 5);
+		storeTriplets(dst + j + 20, high, 3);
+	}
+	scalarPixels(src, dst, j, width, b);
+}
+#endif
+
+struct Kernel {
+	RowKernel row;
+	const char* name;
+};
+
+Kernel selectKernel()
+{
+	Kernel k = {&scalarRow, "scalar"};
+#ifdef THRESHOLD_AVX2
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		k.row = &avx2Row;
+		k.name = "avx2";
+		return k;
+	}
+#endif
+#ifdef __SSE2__
+	k.row = &sse2Row;
+	k.name = "sse2";
+#endif
+	return k;
+}
+
+const Kernel KERNEL = selectKernel();
+
+/* Return the row kernel for k, or NULL if it was not built or the CPU lacks it */
+RowKernel kernelRow(ThresholdKernel k)
+{
+	switch(k) {
+	case SCALAR_KERNEL:
+		return &scalarRow;
+#ifdef __SSE2__
+	case SSE2_KERNEL:
+		return &sse2Row;
+#endif
+#ifdef THRESHOLD_AVX2
+	case AVX2_KERNEL:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? &avx2Row : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+void thresholdRows(RowKernel row, const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue)
+{
+	if(bgr->nChannels != 3) {
+		thresholdBGRScalar(bgr, mask, minRed, maxGreen, maxBlue);
+		return;
+	}
+
+	Bounds b;
+	makeBounds(b, minRed, maxGreen, maxBlue);
+	CvRect from = cvGetImageROI(bgr);
+	CvRect to = cvGetImageROI(mask);
+	for(int i = 0; i < from.height; i++) {
+		unsigned char* dst = (unsigned char*)mask->imageData + (to.y + i)*mask->widthStep + to.x;
+		if(b.empty)
+			memset(dst, 0, from.width);
+		else
+			row((const unsigned char*)bgr->imageData + (from.y + i)*bgr->widthStep + 3*from.x, dst, from.width, b);
+	}
+}
+
+}
+
+void thresholdBGR(const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue)
+{
+	thresholdRows(KERNEL.row, bgr, mask, minRed, maxGreen, maxBlue);
+}
+
+bool thresholdBGRWith(ThresholdKernel kernel, const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue)
+{
+	RowKernel row = kernelRow(kernel);
+	if(!row)
+		return false;
+	thresholdRows(row, bgr, mask, minRed, maxGreen, maxBlue);
+	return true;
+}
+
+void thresholdBGRScalar(const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue)
+{
+	CvRect from = cvGetImageROI(bgr);
+	CvRect to = cvGetImageROI(mask);
+	const unsigned char* data = (const unsigned char*)bgr->imageData + from.y*bgr->widthStep + from.x*bgr->nChannels;
+	unsigned char* datar = (unsigned char*)mask->imageData + to.y*mask->widthStep + to.x;
+	for(int i = 0; i < from.height; i++) {
+		for(int j = 0; j < from.width; j++) {
+			const unsigned char* p = data + i*bgr->widthStep + j*bgr->nChannels;
+			if(p[2] > minRed && p[1] < maxGreen && p[0] < maxBlue)
+				datar[i*mask->widthStep + j] = 255;
+			else
+				datar[i*mask->widthStep + j] = 0;
+		}
+	}
+}
+
+const char* thresholdKernel()
+{
+	return KERNEL.name;
+}
@@ -0,0 +1,35 @@
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include <cv.h>
+
+/**
+ * Mark the pixels of a BGR image whose channels fall within a range: red above minRed, green below maxGreen, and blue
+ * below maxBlue (all strict, as ints, so bounds outside 0-255 simply accept or reject every pixel). Each byte of mask
+ * is set to 255 where a pixel is within range and 0 elsewhere. Only the ROI of bgr is examined, and its mask is
+ * written to the ROI of mask (from its top-left corner).
+ *
+ * Three-channel images are handled 16 or 32 pixels at a time with SSE2 or AVX2, whichever the CPU supports; anything
+ * else falls back to a plain loop. Every path gives exactly the same mask.
+ * @param bgr 8-bit image with the blue, green, and red channels first in each pixel
+ * @param mask 8-bit single-channel image whose ROI is at least as large as that of bgr
+ */
+void thresholdBGR(const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue);
+
+/** Same as thresholdBGR(), but always uses the plain loop; the reference the vector paths must match. */
+void thresholdBGRScalar(const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue);
+
+/** Kernels thresholdBGR() chooses between. */
+enum ThresholdKernel { SCALAR_KERNEL, SSE2_KERNEL, AVX2_KERNEL };
+
+/**
+ * Same as thresholdBGR(), but with the given kernel rather than the one the CPU selects, so that every path can be
+ * checked against thresholdBGRScalar() on one machine.
+ * @return false, leaving mask untouched, if the kernel was not compiled in or the CPU does not support it
+ */
+bool thresholdBGRWith(ThresholdKernel kernel, const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue);
+
+/** @return name of the kernel thresholdBGR() uses on this CPU: "avx2", "sse2", or "scalar" */
+const char* thresholdKernel();
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Checks that every kernel this machine can run, as well as thresholdBGR() itself, gives exactly the same mask as
+ * thresholdBGRScalar() on random images, ROIs, and bounds, including widths that are not a multiple of the vector block
+ * and bounds outside 0-255. Run by "make check"; exits nonzero on the first mismatch. Kernels the CPU lacks are
+ * reported as skipped.
+ */
+#include "threshold.h"
+#include <cv.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+const int WIDTH = 320, HEIGHT = 240;
+const int TRIALS = 2000;
+
+/* Kernels to check, indexed by ThresholdKernel; the last entry stands for thresholdBGR()'s own choice */
+const int KERNELS = 4;
+const char* const NAMES[KERNELS] = {"scalar", "sse2", "avx2", "selected"};
+
+static bool runKernel(int k, const IplImage* bgr, IplImage* mask, int minRed, int maxGreen, int maxBlue)
+{
+	if(k == KERNELS - 1) {
+		thresholdBGR(bgr, mask, minRed, maxGreen, maxBlue);
+		return true;
+	}
+	return thresholdBGRWith((ThresholdKernel)k, bgr, mask, minRed, maxGreen, maxBlue);
+}
+
+static int randomBound()
+{
+	return rand() % 300 - 20;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+	srand(seed);
+
+	IplImage* bgr = cvCreateImage(cvSize(WIDTH, HEIGHT), 8, 3);
+	IplImage* fast = cvCreateImage(cvSize(WIDTH, HEIGHT), 8, 1);
+	IplImage* reference = cvCreateImage(cvSize(WIDTH, HEIGHT), 8, 1);
+	bool checked[KERNELS] = {false, false, false, false};
+
+	for(int trial = 0; trial < TRIALS; trial++) {
+		// Pixels clustered around the bounds half of the time, so both sides of every comparison are exercised
+		int minRed = randomBound(), maxGreen = randomBound(), maxBlue = randomBound();
+		int centre[3] = {maxBlue, maxGreen, minRed};
+		bool near = rand() % 2;
+		for(int y = 0; y < HEIGHT; y++) {
+			unsigned char* row = (unsigned char*)bgr->imageData + y*bgr->widthStep;
+			for(int i = 0; i < WIDTH*3; i++) {
+				int v = near ? centre[i % 3] + rand() % 5 - 2 : rand() % 256;
+				row[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+			}
+		}
+
+		int w = 1 + rand() % WIDTH, h = 1 + rand() % HEIGHT;
+		CvRect roi = cvRect(rand() % (WIDTH - w + 1), rand() % (HEIGHT - h + 1), w, h);
+		cvSetImageROI(bgr, roi);
+		cvSetImageROI(fast, cvRect(0, 0, w, h));
+		cvSetImageROI(reference, cvRect(0, 0, w, h));
+		memset(reference->imageData, 0x55, reference->widthStep*HEIGHT);
+		thresholdBGRScalar(bgr, reference, minRed, maxGreen, maxBlue);
+
+		for(int k = 0; k < KERNELS; k++) {
+			memset(fast->imageData, 0x55, fast->widthStep*HEIGHT);
+			if(!runKernel(k, bgr, fast, minRed, maxGreen, maxBlue))
+				continue;
+			checked[k] = true;
+			if(memcmp(fast->imageData, reference->imageData, reference->widthStep*HEIGHT) != 0) {
+				printf("%s kernel differs from scalar: seed %u, trial %d, ROI %dx%d at (%d,%d), bounds %d %d %d\n",
+					k == KERNELS - 1 ? thresholdKernel() : NAMES[k], seed, trial, w, h, roi.x, roi.y,
+					minRed, maxGreen, maxBlue);
+				return 1;
+			}
+		}
+		cvResetImageROI(bgr);
+	}
+
+	cvReleaseImage(&bgr);
+	cvReleaseImage(&fast);
+	cvReleaseImage(&reference);
+	for(int k = 0; k < KERNELS - 1; k++)
+		printf("%s kernel: %s\n", NAMES[k], checked[k] ? "matches" : "skipped, not built or not supported by this CPU");
+	printf("thresholdBGR() uses %s; all supported kernels match scalar in %d trials\n", thresholdKernel(), TRIALS);
+	return 0;
+}
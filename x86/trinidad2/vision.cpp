@@ -0,0 +1,149 @@
+#include "vision.h"
+#include "globals.h"
+#include "URT/State.h"
+#include <boost/bind.hpp>
+
+Vision::Queue::Queue() : closed(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+Vision::Queue::~Queue()
+{
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+/* Append a job, waiting while the queue is full; a closed queue drops it */
+void Vision::Queue::push(Job* job)
+{
+	pthread_mutex_lock(&mutex);
+	while(jobs.size() >= (size_t)JOBS && !closed)
+		pthread_cond_wait(&cond, &mutex);
+	if(!closed) {
+		jobs.push_back(job);
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Remove the oldest job, waiting while the queue is empty; returns false once the queue is closed */
+bool Vision::Queue::pop(Job*& job)
+{
+	pthread_mutex_lock(&mutex);
+	while(jobs.empty() && !closed)
+		pthread_cond_wait(&cond, &mutex);
+	bool ok = !closed;
+	if(ok) {
+		job = jobs.front();
+		jobs.pop_front();
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&mutex);
+	return ok;
+}
+
+/* Wake every waiting thread and refuse further jobs */
+void Vision::Queue::close()
+{
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Start the pipeline. Its results are published on loop, which must belong to the constructing thread; the camera
+ * must not be used otherwise until the pipeline is destroyed.
+ */
+Vision::Vision(Camera& camera, urt::EventLoop& loop) throw (urt::ThreadException)
+	: camera(camera), loop(loop), stopping(false)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	publish(false, 0, now);
+
+	for(int i = 0; i < JOBS; i++) {
+		jobs[i].mask = cvCreateImage(camera.getFrameSize(), 8, 1);
+		idle.push(&jobs[i]);
+	}
+
+	void (Vision::*runs[3])() = {&Vision::thresholdStage, &Vision::morphologyStage, &Vision::blobStage};
+	for(int i = 0; i < 3; i++) {
+		stages[i].vision = this;
+		stages[i].run = runs[i];
+		if(pthread_create(&stages[i].thread, NULL, &Vision::stageMain, &stages[i]) != 0) {
+			shutdown(i);
+			throw urt::ThreadException("Unable to create Vision thread");
+		}
+	}
+}
+
+/* Stop every stage; results already posted to the loop are still published */
+Vision::~Vision()
+{
+	shutdown(3);
+}
+
+void Vision::shutdown(int started)
+{
+	__atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+	idle.close();
+	thresholded.close();
+	cleaned.close();
+	for(int i = 0; i < started; i++)
+		pthread_join(stages[i].thread, NULL);
+	for(int i = 0; i < JOBS; i++)
+		cvReleaseImage(&jobs[i].mask);
+}
+
+void* Vision::stageMain(void* s)
+{
+	Stage* stage = static_cast<Stage*>(s);
+	(stage->vision->*stage->run)();
+	return NULL;
+}
+
+void Vision::thresholdStage()
+{
+	Job* job;
+	while(idle.pop(job)) {
+		IplImage* frame = NULL;
+		while(!frame && !__atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+			frame = camera.takeFrame(job->stamp, FRAME_WAIT);
+		if(!frame)
+			return;
+		job->region = camera.threshold(frame, job->mask);
+		thresholded.push(job);
+	}
+}
+
+void Vision::morphologyStage()
+{
+	Job* job;
+	while(thresholded.pop(job)) {
+		camera.morphology(job->mask, job->region);
+		cleaned.push(job);
+	}
+}
+
+void Vision::blobStage()
+{
+	Job* job;
+	while(cleaned.pop(job)) {
+		double heading;
+		CvRect bound;
+		bool coneExists = camera.locate(job->mask, job->region, heading, bound);
+		loop.post(boost::bind(&Vision::publish, coneExists, heading, job->stamp));
+		idle.push(job);
+	}
+}
+
+/* Runs on the loop's thread. The cone's presence is set last so its slots see the matching heading and time */
+void Vision::publish(bool coneExists, double heading, timespec stamp)
+{
+	urt::State::set(CONE_HEADING_KEY, heading);
+	urt::State::set(CONE_TIME_KEY, (long)stamp.tv_sec * 1000 + stamp.tv_nsec / 1000000);
+	urt::State::set(CONE_KEY, coneExists);
+}
@@ -0,0 +1,76 @@
+#ifndef VISION_H
+#define VISION_H
+
+#include "camera.h"
+#include "URT/EventLoop.h"
+#include "URT/urtexcept.h"
+#include <boost/utility.hpp>
+#include <deque>
+#include <pthread.h>
+#include <ctime>
+
+/**
+ * Runs cone detection off the EventLoop as a pipeline: Camera's capture thread, then threshold, morphology, and blob
+ * extraction, each on a thread of its own, so every stage works on a different frame at once. Masks are passed
+ * between stages on bounded queues; a stage that gets ahead waits for the next, while the capture thread keeps only
+ * the freshest frame, so a slow stage drops frames instead of adding latency.
+ *
+ * Each result is posted to the loop, which sets CONE_KEY, CONE_HEADING_KEY, and CONE_TIME_KEY (the CLOCK_MONOTONIC
+ * millisecond at which the frame was captured). AutoPilot reads them like any other substate.
+ */
+class Vision : boost::noncopyable {
+public:
+	Vision(Camera& camera, urt::EventLoop& loop) throw (urt::ThreadException);
+	~Vision();
+
+private:
+	static const int JOBS = 3; ///< Masks in flight; one per stage after capture
+	static const int FRAME_WAIT = 100; ///< Milliseconds to wait for a frame before checking for shutdown
+
+	/** A mask on its way down the pipeline. */
+	struct Job {
+		IplImage* mask;
+		timespec stamp; ///< When its frame was captured
+		Camera::Region region; ///< Part of the frame the mask covers
+	};
+
+	/** Blocking FIFO of at most JOBS jobs. */
+	class Queue : boost::noncopyable {
+	public:
+		Queue();
+		~Queue();
+		void push(Job* job);
+		bool pop(Job*& job);
+		void close();
+	private:
+		std::deque<Job*> jobs;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond; ///< Signalled when a job is pushed or popped, or the queue is closed
+		bool closed;
+	};
+
+	/** A stage and the thread running it. */
+	struct Stage {
+		Vision* vision;
+		void (Vision::*run)();
+		pthread_t thread;
+	};
+
+	void thresholdStage();
+	void morphologyStage();
+	void blobStage();
+	void shutdown(int started);
+	static void* stageMain(void* stage);
+	static void publish(bool coneExists, double heading, timespec stamp);
+
+	Camera& camera;
+	urt::EventLoop& loop;
+	Job jobs[JOBS];
+	Queue idle; ///< Jobs waiting for a frame
+	Queue thresholded;
+	Queue cleaned; ///< Thresholded jobs after erosion and dilation
+	Stage stages[3];
+	bool stopping; ///< Accessed atomically
+};
+
+#endif